@@ -1,6 +1,7 @@
 #ifndef FAT16_H
 #define FAT16_H
 
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -92,6 +93,58 @@ typedef struct {
 
 #pragma pack(pop)
 
+/* Pontos de entrada públicos com histograma de latência (fat16_stats). */
+enum {
+  FAT16_OP_LIST_DIR,
+  FAT16_OP_LIST_PATH,
+  FAT16_OP_SHOW_FILE,
+  FAT16_OP_SHOW_ATTRS,
+  FAT16_OP_RENAME,
+  FAT16_OP_DELETE,
+  FAT16_OP_CREATE,
+  FAT16_OP_IMPORT,
+  FAT16_OP_LOOKUP,
+  FAT16_OP_LOOKUP_PATH,
+  FAT16_OP_READ, /* fat16_reader_read */
+  FAT16_OP_PREAD,
+  FAT16_OP_FILE_SPANS,
+  FAT16_OP_FLUSH,
+  FAT16_OP_CHECK,
+  FAT16_OP_DEFRAG,
+  FAT16_OP_EXTRACT,
+  FAT16_OP_WRITE, /* fat16_write_at */
+  FAT16_OP_APPEND,
+  FAT16_OP_TRUNCATE,
+  FAT16_OP_OVERLAY_COMMIT,
+  FAT16_OP_READDIR,
+  FAT16_OP_COUNT
+};
+
+/* Baldes do histograma: o balde i conta chamadas com latência em
+ * [2^(i-1), 2^i) µs (o 0, abaixo de 1 µs); o último junta o resto. */
+#define FAT16_LAT_BUCKETS 24
+
+typedef struct {
+  uint64_t calls;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t hist[FAT16_LAT_BUCKETS];
+} Fat16OpStats;
+
+/* Contadores de instrumentação. seeks/reads/writes/bytes contam a E/S que
+ * chega de fato à imagem (acertos do cache de blocos não entram); um seek
+ * é um acesso que não começa onde o anterior terminou. */
+typedef struct {
+  uint64_t seeks;
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t fat_walked;      /* entradas da FAT seguidas em cadeias */
+  uint64_t dirents_scanned; /* entradas de diretório examinadas */
+  Fat16OpStats ops[FAT16_OP_COUNT];
+} Fat16Stats;
+
 /*
  * Fat16Ctx (contexto de trabalho)
  * -------------------------------
@@ -106,6 +159,11 @@ typedef struct {
 typedef struct {
   /* recursos principais */
   FILE *img;
+  /* backend mmap (FAT16_OPEN_MMAP): a imagem inteira fica mapeada e
+   * fat/root apontam para dentro do mapa; map == NULL → backend stdio */
+  uint8_t *map;
+  size_t map_len;  /* bytes reservados (>= tamanho do volume) */
+  size_t map_size; /* bytes válidos (tamanho atual do arquivo) */
   BootSector bpb;
   DirectoryEntry *root;
   uint16_t *fat;
@@ -119,26 +177,315 @@ typedef struct {
   uint32_t first_data_sector; /* onde começa a área de dados (cluster 2) */
   uint32_t data_sectors;
   uint32_t cluster_count; /* quantidade total de clusters de dados */
+  uint32_t cluster_limit; /* 1º cluster inválido: min(fat_entries, count+2) */
+
+  /* índice de clusters livres: bit=1 → cluster livre; free_sum marca as
+   * palavras de free_map que ainda têm algum bit ligado */
+  uint64_t *free_map;
+  uint64_t *free_sum;
+  uint32_t free_words;
+  uint32_t free_count;
+
+  /* índice do diretório raiz: hash do nome 8.3 → posição em root (só
+   * entradas regulares) e bitmap de entradas livres (bit=1 → livre) */
+  int32_t *name_head; /* baldes: índice em root ou -1 */
+  int32_t *name_next; /* próximo índice no mesmo balde, por entrada */
+  uint32_t name_mask;
+  uint64_t *slot_free;
+  uint32_t slot_words;
+
+  /* setores alterados desde o último save (1 byte por setor): a FAT suja
+   * é regravada em todas as cópias, só nos setores marcados */
+  uint8_t *fat_dirty;  /* bpb.fat_size_16 setores */
+  uint8_t *root_dirty; /* root_dir_sectors setores */
+
+  /* cache de extents por arquivo (fat16_pread), chaveado pelo 1º cluster */
+  struct Fat16ExtCache *ext_cache;
+
+  /* cache de subdiretórios: clusters lidos (LRU) e caminho → entrada */
+  struct Fat16DirCache *dir_cache;
+
+  /* cache de blocos com write-back (cache_blocks > 0, backend stdio) */
+  struct Fat16BlockCache *bcache;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t cache_writebacks;
+
+  /* anel io_uring (FAT16_OPEN_URING): E/S de clusters em lote */
+  struct Fat16Uring *uring;
+
+  /* modo esparso (FAT16_OPEN_SPARSE): delete abre buracos no arquivo da
+   * imagem e clusters só de zeros importados não são gravados */
+  int sparse;
+
+  /* cópia de dados do import no kernel: 2 → copy_file_range, 1 → sendfile,
+   * 0 → buffer (cai um nível quando o host não suporta) */
+  int kcopy;
+
+  /* journal de metadados (FAT16_OPEN_JOURNAL): FAT e raiz vão para
+   * "<imagem>.jnl" em commits de grupo antes de serem gravadas no lugar */
+  struct Fat16Journal *journal;
+
+  /* overlay copy-on-write (FAT16_OPEN_OVERLAY): img aberta só para leitura
+   * e as escritas vão para um delta em memória ou em arquivo */
+  struct Fat16Overlay *overlay;
+
+  /* abertura lazy (FAT16_OPEN_LAZY): só o boot é lido ao abrir. Setores da
+   * FAT entram em fat_loaded quando uma cadeia passa por eles (fat_pending
+   * → quantos faltam); a raiz (root_pending) e os índices de nomes e de
+   * livres são montados no primeiro uso */
+  int lazy;
+  uint8_t *fat_loaded; /* bpb.fat_size_16 setores; NULL → FAT toda lida */
+  uint32_t fat_pending;
+  int root_pending;
+  int names_ready;
+  int free_ready;
+
+  /* instrumentação (fat16_stats): atualizada com operações atômicas;
+   * io_next é o offset onde terminou o último acesso à imagem */
+  Fat16Stats stats;
+  long io_next;
+
+  /* concorrência: lock admite vários leitores (listar, ler, pread) ou um
+   * escritor (create, rename, delete, flush). cache_lock protege o cache de
+   * blocos e o anel io_uring; dcache_lock os caches de diretórios e de extents;
+   * page_lock a leitura de setores da FAT no modo lazy. Ordem de aquisição:
+   * lock, dcache_lock, page_lock, cache_lock. */
+  pthread_rwlock_t lock;
+  pthread_mutex_t cache_lock;
+  pthread_mutex_t dcache_lock;
+  pthread_mutex_t page_lock;
+  int locks_ready;
 } Fat16Ctx;
 
+/* Opções de abertura (fat16_open_ex). */
+#define FAT16_OPEN_MMAP 0x01  /* mapeia a imagem em vez de usar stdio */
+#define FAT16_OPEN_URING 0x02 /* E/S de clusters em lote via io_uring */
+#define FAT16_OPEN_SPARSE 0x04 /* devolve ao host clusters livres e zerados */
+#define FAT16_OPEN_JOURNAL 0x08 /* metadados via journal, commit em grupo */
+#define FAT16_OPEN_NO_KCOPY 0x10 /* import sempre por buffer em espaço de
+                                    usuário (sem copy_file_range/sendfile) */
+#define FAT16_OPEN_OVERLAY 0x20  /* base somente leitura, escritas num delta
+                                    (copy-on-write) */
+#define FAT16_OPEN_LAZY 0x40  /* só o boot na abertura; FAT, raiz e índices
+                                 sob demanda */
+#define FAT16_OPEN_QUIET 0x80 /* abertura sem o resumo do volume */
+
+/* Políticas de substituição do cache de blocos. */
+#define FAT16_CACHE_LRU 0
+#define FAT16_CACHE_CLOCK 1
+
+typedef struct {
+  unsigned flags;        /* combinação de FAT16_OPEN_* */
+  uint32_t cache_blocks; /* blocos (setores) no cache; 0 → sem cache */
+  int cache_policy;      /* FAT16_CACHE_LRU ou FAT16_CACHE_CLOCK */
+  uint32_t uring_depth;  /* entradas do anel io_uring; 0 → 64 */
+  uint32_t journal_ops;  /* operações por commit do journal; 0 → 64 */
+  const char *overlay_path; /* FAT16_OPEN_OVERLAY: arquivo delta; NULL →
+                               delta em memória */
+} Fat16Options;
+
+/* Contadores do cache de blocos (fat16_cache_stats). */
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t writebacks; /* blocos sujos gravados na imagem */
+  uint32_t blocks;     /* capacidade (0 → cache desligado) */
+  uint32_t block_size;
+  uint32_t dirty; /* blocos sujos no momento */
+} Fat16CacheStats;
+
+/* Resultado de fat16_check (contagens de problemas encontrados). */
+#define FAT16_CHECK_REPAIR 0x01 /* corrige o que encontrar */
+
+typedef struct {
+  uint32_t files, dirs;   /* entradas verificadas */
+  uint32_t cross_linked;  /* cadeias que entram num cluster de outra */
+  uint32_t bad_chain;     /* cadeias com cluster livre, BAD ou fora do limite */
+  uint32_t size_mismatch; /* tamanho incompatível com o comprimento da cadeia */
+  uint32_t lost;          /* clusters em uso sem nenhum dono */
+  uint32_t fat_mismatch;  /* setores em que as cópias da FAT divergem */
+  uint32_t repaired;      /* correções aplicadas (FAT16_CHECK_REPAIR) */
+} Fat16CheckReport;
+
+/* Resultado de fat16_defrag. */
+#define FAT16_DEFRAG_DRY_RUN 0x01 /* só relata o que seria feito */
+
+typedef struct {
+  uint32_t files;          /* arquivos com cadeia examinados */
+  uint32_t fragmented;     /* com mais de um extent antes */
+  uint32_t extents_before; /* soma dos extents antes */
+  uint32_t extents_after;  /* depois (previsto, na simulação) */
+  uint32_t clusters_moved; /* clusters copiados (ou a copiar) */
+} Fat16DefragReport;
+
+typedef struct {
+  uint32_t files;   /* arquivos gravados no host */
+  uint32_t dirs;    /* pastas criadas */
+  uint32_t skipped; /* entradas com cadeia inválida (não extraídas) */
+  uint32_t reads;   /* leituras na área de dados */
+  uint64_t bytes;   /* bytes de arquivos extraídos */
+} Fat16ExtractReport;
+
+/* Trecho contíguo de um arquivo dentro da imagem mapeada. */
+typedef struct {
+  const uint8_t *data;
+  uint32_t len;
+} Fat16Span;
+
+/*
+ * Fat16Reader (leitura em streaming)
+ * ----------------------------------
+ * Estado de leitura sequencial de um arquivo: a FAT é percorrida sob
+ * demanda e clusters fisicamente contíguos viram uma única leitura.
+ */
+typedef struct {
+  Fat16Ctx *ctx;
+  uint32_t size;   /* tamanho do arquivo em bytes */
+  uint32_t pos;    /* bytes já entregues */
+  uint16_t cur;    /* cluster que contém a posição atual */
+  uint32_t off_in; /* offset dentro de cur (== cluster_size → avançar) */
+  uint32_t steps;  /* clusters percorridos (detecção de loop) */
+  int error;
+} Fat16Reader;
+
 /* ======== API PÚBLICA ======== */
 
-/* Abre e carrega uma imagem FAT16 (somente raiz). Retorna 0 em erro. */
+/* Abre e carrega uma imagem FAT16 (somente raiz). Se existir
+ * "<imagem>.jnl" de uma sessão interrompida, as transações completas são
+ * reaplicadas antes. Retorna 0 em erro. */
 int fat16_open(Fat16Ctx *ctx, const char *img_path);
+/* Igual a fat16_open, com opções (opt pode ser NULL). */
+int fat16_open_ex(Fat16Ctx *ctx, const char *img_path, const Fat16Options *opt);
 
-/* Salva FAT e root de volta (em geral operações já salvam). */
+/* Grava os setores sujos da FAT (todas as cópias) e do root (em geral as
+ * operações já salvam; com journal, faz o commit do grupo pendente) e
+ * esvazia os blocos sujos do cache. */
 int fat16_flush(Fat16Ctx *ctx);
 
+/* Overlay (FAT16_OPEN_OVERLAY): grava o delta na imagem base e recomeça
+ * com o delta vazio. Sem chamar, o delta em memória é descartado no
+ * fat16_close e o delta em arquivo fica para a próxima abertura (apagar o
+ * arquivo descarta as alterações). Retorna 0 em erro ou sem overlay. */
+int fat16_overlay_commit(Fat16Ctx *ctx);
+
 /* Fecha e libera tudo. */
 void fat16_close(Fat16Ctx *ctx);
 
-/* Operações solicitadas no enunciado (válidas apenas no diretório raiz): */
+/* Operações solicitadas no enunciado. Leituras (show_file/show_attrs)
+ * também aceitam caminhos como "PASTA/SUB/ARQ.TXT"; alterações valem apenas
+ * no diretório raiz. */
 void fat16_list_dir(Fat16Ctx *ctx);
+/* Lista um subdiretório por caminho ("/" ou "" → raiz). */
+void fat16_list_path(Fat16Ctx *ctx, const char *path);
 void fat16_show_file(Fat16Ctx *ctx, const char *name83);
 void fat16_show_attrs(Fat16Ctx *ctx, const char *name83);
-void fat16_rename(Fat16Ctx *ctx, const char *old83, const char *new83);
-void fat16_delete(Fat16Ctx *ctx, const char *name83);
-void fat16_create(Fat16Ctx *ctx, const char *host_src_path, const char *dest83);
+/* rename, delete e create retornam 1 se a alteração foi feita, 0 se não. */
+int fat16_rename(Fat16Ctx *ctx, const char *old83, const char *new83);
+int fat16_delete(Fat16Ctx *ctx, const char *name83);
+int fat16_create(Fat16Ctx *ctx, const char *host_src_path, const char *dest83);
+/* Igual a fat16_create, com o conteúdo vindo de buf (len bytes). */
+int fat16_create_mem(Fat16Ctx *ctx, const char *dest83, const void *buf,
+                     size_t len);
+
+/* Importa n arquivos do host de uma vez: aloca todas as cadeias, grava os
+ * dados e salva FAT/raiz uma única vez no final. dest83 pode ser NULL (ou ter
+ * posições NULL) para usar o nome do arquivo no host. Retorna quantos foram
+ * criados. */
+int fat16_import_batch(Fat16Ctx *ctx, const char *const *host_paths,
+                       const char *const *dest83, int n);
+
+/* Alteram um arquivo da raiz no lugar, sem recriá-lo: a cadeia existente é
+ * reaproveitada, cresce a partir do último cluster ou é liberada a partir
+ * do fim, e só os clusters tocados são regravados. write_at grava len bytes
+ * em offset (um buraco além do fim vira zeros) e append grava no fim; ambos
+ * retornam os bytes gravados ou -1. truncate corta ou estende (com zeros)
+ * até size e retorna 0 em erro. */
+long fat16_write_at(Fat16Ctx *ctx, const char *name83, uint32_t offset,
+                    const void *buf, size_t len);
+long fat16_append(Fat16Ctx *ctx, const char *name83, const void *buf,
+                  size_t len);
+int fat16_truncate(Fat16Ctx *ctx, const char *name83, uint32_t size);
+
+/* Modo mmap: preenche até max trechos apontando direto para o conteúdo de
+ * name83 dentro do mapa (sem cópia). Retorna o total de trechos do arquivo
+ * (pode ser > max) ou -1 em erro/sem mmap. Válido até a próxima escrita. */
+int fat16_file_spans(Fat16Ctx *ctx, const char *name83, Fat16Span *spans,
+                     int max);
+
+/* Copia até max entradas (arquivos e pastas, sem "." e "..") do diretório
+ * path ("" ou "/" → raiz) para out, sem imprimir nada. Retorna o total de
+ * entradas (pode ser > max) ou -1 se path não é um diretório. */
+int fat16_readdir(Fat16Ctx *ctx, const char *path, DirectoryEntry *out,
+                  int max);
+
+/* Entrada regular do diretório raiz com esse nome 8.3 (NULL se não há).
+ * O ponteiro aponta para a raiz em memória: deixa de valer após qualquer
+ * alteração (create, rename, delete) feita por outra thread. */
+const DirectoryEntry *fat16_lookup(Fat16Ctx *ctx, const char *name83);
+
+/* Resolve um caminho a partir da raiz (ex.: "DOCS/2024/NOTAS.TXT") e copia
+ * a entrada (arquivo ou pasta) para out. Retorna 0 se não existe. */
+int fat16_lookup_path(Fat16Ctx *ctx, const char *path, DirectoryEntry *out);
+
+/* Leitura em streaming: open prepara r para o arquivo e; read copia até len
+ * bytes para buf e retorna quantos leu (0 no fim, -1 em erro); close libera
+ * o leitor. */
+int fat16_reader_open(Fat16Ctx *ctx, const DirectoryEntry *e, Fat16Reader *r);
+long fat16_reader_read(Fat16Reader *r, void *buf, size_t len);
+void fat16_reader_close(Fat16Reader *r);
+
+/* Lê até len bytes de e a partir de offset (acesso aleatório). Usa a lista
+ * de extents do arquivo, montada no 1º acesso e mantida em cache. Retorna
+ * os bytes lidos (0 se offset >= tamanho) ou -1 em erro. */
+long fat16_pread(Fat16Ctx *ctx, const DirectoryEntry *e, uint32_t offset,
+                 size_t len, void *buf);
+
+/* Contadores de acerto/falha do cache de blocos. */
+void fat16_cache_stats(Fat16Ctx *ctx, Fat16CacheStats *st);
+
+/* Verifica o volume inteiro numa passada O(clusters): ligações cruzadas,
+ * cadeias inválidas, tamanhos incompatíveis, clusters perdidos e cópias da
+ * FAT divergentes. threads <= 0 escolhe automaticamente. Com
+ * FAT16_CHECK_REPAIR corrige (corta cadeias, ajusta tamanhos, libera
+ * perdidos, regrava as cópias da FAT). Retorna o número de problemas
+ * encontrados (0 → consistente) ou -1 em erro; rep pode ser NULL. */
+int fat16_check(Fat16Ctx *ctx, unsigned flags, int threads,
+                Fat16CheckReport *rep);
+
+/* Deixa a cadeia de cada arquivo (raiz e subdiretórios) contígua,
+ * copiando só os clusters fora do lugar, e imprime os extents de cada
+ * arquivo antes e depois. Com FAT16_DEFRAG_DRY_RUN nada é gravado. Pastas
+ * não são movidas. Retorna 1 se concluiu; rep pode ser NULL. */
+int fat16_defrag(Fat16Ctx *ctx, unsigned flags, Fat16DefragReport *rep);
+
+/* Copia todos os arquivos do volume (raiz e subdiretórios, recriando as
+ * pastas) para host_dir, criado se preciso. A área de dados é lida numa
+ * única varredura em ordem de cluster físico, com leituras grandes, e cada
+ * pedaço é gravado no arquivo de destino certo. Arquivos com cadeia
+ * inválida são ignorados. Retorna 1 se concluiu; rep pode ser NULL. */
+int fat16_extract(Fat16Ctx *ctx, const char *host_dir,
+                  Fat16ExtractReport *rep);
+
+/* Cópia dos contadores e histogramas de instrumentação; reset zera tudo. */
+void fat16_stats(Fat16Ctx *ctx, Fat16Stats *st);
+void fat16_stats_reset(Fat16Ctx *ctx);
+/* Nome curto da operação FAT16_OP_* ("show_file", "pread", ...). */
+const char *fat16_op_name(int op);
+/* Imprime os contadores e, por operação chamada, média, máximo e
+ * percentis aproximados (limite superior do balde). */
+void fat16_show_stats(Fat16Ctx *ctx);
+/* Grava os contadores, os histogramas e o cache de blocos como JSON em
+ * out. Retorna 0 em erro de escrita. */
+int fat16_stats_json(Fat16Ctx *ctx, FILE *out);
+
+/* Versão dos kernels de varredura da FAT/diretórios escolhida para esta
+ * CPU: "avx2", "sse2" ou "escalar" (FAT16_SIMD no ambiente força uma). */
+const char *fat16_scan_impl(void);
+
+/* Quantidade de clusters livres (mantida pelo índice, sem varrer a FAT;
+ * no modo lazy a primeira chamada monta o índice). */
+uint32_t fat16_free_clusters(Fat16Ctx *ctx);
 
 /* Converte um nome "livre" para formato 8.3 (CAIXA ALTA, preenchido com
  * espaços). */
@@ -0,0 +1,458 @@
+/*
+ * fat16_bench — gera imagens FAT16 sintéticas e mede as operações da
+ * biblioteca (open, list, lookup, read, create, rename, delete).
+ *
+ * Uso: fat16_bench [--size=MB] [--bps=N] [--spc=N] [--root=N] [--fill=%]
+ *                  [--frag=%] [--iters=N] [--seed=N] [--img=arq]
+ *                  [--mmap] [--cache=N] [--uring] [--sparse] [--lazy]
+ *
+ * --fill é a fração dos clusters ocupada por arquivos e --frag a chance de
+ * cada cluster de um arquivo saltar para um ponto livre aleatório em vez de
+ * seguir o anterior. A imagem é criada esparsa (clusters livres são
+ * buracos no arquivo). O relatório (latências em µs e vazão) vai para a saída
+ * padrão; as mensagens da biblioteca são descartadas durante as medições.
+ */
+#include "fat16.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+  uint32_t size_mb;
+  uint32_t bps, spc, root;
+  uint32_t fill, frag; /* em % */
+  uint32_t iters;
+  uint32_t seed;
+  char img[256];
+  Fat16Options opts;
+} BenchCfg;
+
+/* ----- gerador de números (xorshift, reprodutível pela semente) ----- */
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+  uint32_t x = rng_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return rng_state = x;
+}
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+/* ----- geração da imagem ----- */
+
+static void put16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  put16(p, (uint16_t)v);
+  put16(p + 2, (uint16_t)(v >> 16));
+}
+
+/* Próximo cluster livre a partir de c (circular); 0 se não há. */
+static uint32_t next_free(const uint16_t *fat, uint32_t limit, uint32_t c) {
+  for (uint32_t i = 0; i < limit - 2; i++) {
+    uint32_t k = 2 + (c - 2 + i) % (limit - 2);
+    if (fat[k] == FAT16_FREE)
+      return k;
+  }
+  return 0;
+}
+
+/*
+ * Cria a imagem descrita em cfg: boot, FATs, raiz com arquivos F00000.DAT…
+ * até atingir cfg->fill e a área de dados preenchida com um padrão.
+ * Retorna o número de arquivos gerados (-1 em erro).
+ */
+static int make_image(const BenchCfg *cfg) {
+  uint32_t bps = cfg->bps, spc = cfg->spc;
+  uint32_t total = (uint32_t)((uint64_t)cfg->size_mb * 1048576u / bps);
+  uint32_t rds = (cfg->root * 32 + bps - 1) / bps;
+  uint32_t fs = 1, clusters;
+  for (;;) {
+    clusters = (total - 1 - 2 * fs - rds) / spc;
+    uint32_t need = ((clusters + 2) * 2 + bps - 1) / bps;
+    if (need <= fs)
+      break;
+    fs = need;
+  }
+  if (clusters < 4085 || clusters > 65524) {
+    printf("Geometria fora de FAT16 (%u clusters).\n", clusters);
+    return -1;
+  }
+  uint32_t limit = clusters + 2, cs = bps * spc;
+
+  uint16_t *fat = (uint16_t *)calloc(limit, sizeof(uint16_t));
+  uint8_t *rootb = (uint8_t *)calloc(rds, bps);
+  uint8_t *buf = (uint8_t *)malloc(cs);
+  FILE *f = fopen(cfg->img, "wb");
+  if (!fat || !rootb || !buf || !f) {
+    printf("Não consegui criar '%s'.\n", cfg->img);
+    free(fat);
+    free(rootb);
+    free(buf);
+    if (f)
+      fclose(f);
+    return -1;
+  }
+  fat[0] = 0xFFF8;
+  fat[1] = 0xFFFF;
+
+  /* deixa 64 entradas livres na raiz para o create/rename */
+  uint32_t max_files = cfg->root > 64 ? cfg->root - 64 : 1;
+  uint32_t target = (uint32_t)((uint64_t)clusters * cfg->fill / 100);
+  uint32_t avg = target / max_files + 1;
+  uint32_t used = 0, cursor = 2;
+  int nfiles = 0;
+  while ((uint32_t)nfiles < max_files && used < target) {
+    uint32_t n = 1 + rng() % (2 * avg);
+    if (n > target - used)
+      n = target - used;
+    uint32_t first = next_free(fat, limit, cursor), prev = 0;
+    if (!first)
+      break;
+    for (uint32_t k = 0; k < n; k++) {
+      uint32_t c;
+      if (k == 0)
+        c = first;
+      else if (rng() % 100 < cfg->frag)
+        c = next_free(fat, limit, 2 + rng() % clusters);
+      else
+        c = next_free(fat, limit, prev + 1);
+      if (prev)
+        fat[prev] = (uint16_t)c;
+      fat[c] = FAT16_EOF;
+      prev = c;
+    }
+    cursor = prev + 1;
+    used += n;
+
+    uint8_t *e = rootb + (size_t)nfiles * 32;
+    char name[16];
+    snprintf(name, sizeof(name), "F%05dDAT", nfiles);
+    memset(e, ' ', 11);
+    memcpy(e, name, 6);
+    memcpy(e + 8, name + 6, 3);
+    e[11] = ATTR_ARCHIVE;
+    put16(e + 26, (uint16_t)first);
+    put32(e + 28, n * cs - rng() % cs);
+    nfiles++;
+  }
+
+  uint8_t *boot = (uint8_t *)calloc(1, bps);
+  if (!boot) {
+    fclose(f);
+    free(fat);
+    free(rootb);
+    free(buf);
+    return -1;
+  }
+  memcpy(boot, "\xEB\x3C\x90MSDOS5.0", 11);
+  put16(boot + 11, (uint16_t)bps);
+  boot[13] = (uint8_t)spc;
+  put16(boot + 14, 1);
+  boot[16] = 2;
+  put16(boot + 17, (uint16_t)cfg->root);
+  if (total < 65536)
+    put16(boot + 19, (uint16_t)total);
+  else
+    put32(boot + 32, total);
+  boot[21] = 0xF8;
+  put16(boot + 22, (uint16_t)fs);
+  boot[38] = 0x29;
+  memcpy(boot + 43, "BENCH      FAT16   ", 19);
+  boot[510] = 0x55;
+  boot[511] = 0xAA;
+
+  int ok = fwrite(boot, 1, bps, f) == bps;
+  uint8_t *fatb = (uint8_t *)calloc(fs, bps);
+  if (!fatb)
+    ok = 0;
+  for (uint32_t i = 0; ok && i < limit; i++)
+    put16(fatb + 2 * i, fat[i]);
+  for (int i = 0; ok && i < 2; i++)
+    ok = fwrite(fatb, bps, fs, f) == fs;
+  if (ok)
+    ok = fwrite(rootb, bps, rds, f) == rds;
+  /* só os clusters em uso recebem dados: os livres ficam como buracos e a
+   * imagem nasce esparsa */
+  long data_off = (long)(1 + 2 * fs + rds) * bps;
+  for (uint32_t c = 2; ok && c < limit; c++) {
+    if (fat[c] == FAT16_FREE)
+      continue;
+    memset(buf, (int)(c & 0xFF), cs);
+    ok = fseek(f, data_off + (long)(c - 2) * cs, SEEK_SET) == 0 &&
+         fwrite(buf, 1, cs, f) == cs;
+  }
+  if (ok)
+    ok = fflush(f) == 0 && ftruncate(fileno(f), (off_t)total * bps) == 0;
+  if (fclose(f) != 0)
+    ok = 0;
+  free(fatb);
+  free(boot);
+  free(fat);
+  free(rootb);
+  free(buf);
+  if (!ok) {
+    printf("Erro ao gravar '%s'.\n", cfg->img);
+    return -1;
+  }
+  return nfiles;
+}
+
+/* ----- medições ----- */
+
+typedef struct {
+  const char *name;
+  double *lat; /* µs por operação */
+  int n, cap;
+  uint64_t bytes;
+} Series;
+
+static void series_add(Series *s, double us) {
+  if (s->n == s->cap) {
+    int cap = s->cap ? s->cap * 2 : 64;
+    double *p = (double *)realloc(s->lat, sizeof(double) * (size_t)cap);
+    if (!p)
+      return;
+    s->lat = p;
+    s->cap = cap;
+  }
+  s->lat[s->n++] = us;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double pct(const Series *s, double p) {
+  int i = (int)(p / 100.0 * (s->n - 1) + 0.5);
+  return s->lat[i];
+}
+
+static void series_report(Series *s) {
+  if (s->n == 0)
+    return;
+  qsort(s->lat, (size_t)s->n, sizeof(double), cmp_double);
+  double sum = 0;
+  for (int i = 0; i < s->n; i++)
+    sum += s->lat[i];
+  printf("%-8s %6d %10.1f %10.1f %10.1f %10.1f %10.0f", s->name, s->n,
+         pct(s, 50), pct(s, 90), pct(s, 99), s->lat[s->n - 1],
+         s->n / (sum / 1e6));
+  if (s->bytes)
+    printf(" %9.1f", (double)s->bytes / 1048576.0 / (sum / 1e6));
+  printf("\n");
+  free(s->lat);
+}
+
+/* Silencia a saída padrão (mensagens da biblioteca) durante as medições. */
+static int quiet_fd = -1;
+
+static void quiet(int on) {
+  fflush(stdout);
+  if (on) {
+    int null = open("/dev/null", O_WRONLY);
+    quiet_fd = dup(1);
+    dup2(null, 1);
+    close(null);
+  } else if (quiet_fd >= 0) {
+    dup2(quiet_fd, 1);
+    close(quiet_fd);
+    quiet_fd = -1;
+  }
+}
+
+static void file_name(char *out, size_t n, int i) {
+  snprintf(out, n, "F%05d.DAT", i);
+}
+
+static int run_bench(const BenchCfg *cfg, int nfiles) {
+  Series s_open = {"open", 0, 0, 0, 0}, s_list = {"list", 0, 0, 0, 0};
+  Series s_look = {"lookup", 0, 0, 0, 0}, s_read = {"read", 0, 0, 0, 0};
+  Series s_create = {"create", 0, 0, 0, 0}, s_ren = {"rename", 0, 0, 0, 0};
+  Series s_del = {"delete", 0, 0, 0, 0};
+  Fat16Ctx ctx;
+  char name[16], other[16];
+  double t;
+
+  quiet(1);
+  for (uint32_t i = 0; i < cfg->iters; i++) {
+    t = now_us();
+    int ok = fat16_open_ex(&ctx, cfg->img, &cfg->opts);
+    series_add(&s_open, now_us() - t);
+    if (!ok) {
+      quiet(0);
+      printf("Falha ao abrir '%s'.\n", cfg->img);
+      return 1;
+    }
+    fat16_close(&ctx);
+  }
+  if (!fat16_open_ex(&ctx, cfg->img, &cfg->opts)) {
+    quiet(0);
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < cfg->iters; i++) {
+    t = now_us();
+    fat16_list_dir(&ctx);
+    series_add(&s_list, now_us() - t);
+  }
+
+  DirectoryEntry e;
+  for (uint32_t i = 0; i < cfg->iters * 16 && nfiles > 0; i++) {
+    file_name(name, sizeof(name), (int)(rng() % (uint32_t)nfiles));
+    t = now_us();
+    fat16_lookup_path(&ctx, name, &e);
+    series_add(&s_look, now_us() - t);
+  }
+
+  size_t cap = 1u << 20;
+  uint8_t *buf = (uint8_t *)malloc(cap);
+  for (uint32_t i = 0; buf && i < cfg->iters && nfiles > 0; i++) {
+    file_name(name, sizeof(name), (int)(rng() % (uint32_t)nfiles));
+    if (!fat16_lookup_path(&ctx, name, &e))
+      continue;
+    if (e.file_size > cap) {
+      uint8_t *p = (uint8_t *)realloc(buf, e.file_size);
+      if (!p)
+        break;
+      buf = p;
+      cap = e.file_size;
+    }
+    t = now_us();
+    long got = fat16_pread(&ctx, &e, 0, e.file_size, buf);
+    series_add(&s_read, now_us() - t);
+    if (got > 0)
+      s_read.bytes += (uint64_t)got;
+  }
+
+  /* origem do create: 16 clusters de dados no host */
+  char src[300];
+  snprintf(src, sizeof(src), "%s.src", cfg->img);
+  size_t src_len = (size_t)16 * cfg->bps * cfg->spc;
+  FILE *hf = fopen(src, "wb");
+  if (hf && buf && src_len <= cap) {
+    memset(buf, 'b', src_len);
+    fwrite(buf, 1, src_len, hf);
+  }
+  if (hf)
+    fclose(hf);
+
+  uint32_t rounds = cfg->iters < 64 ? cfg->iters : 64;
+  for (uint32_t i = 0; i < rounds; i++) {
+    snprintf(name, sizeof(name), "B%05u.TMP", i);
+    t = now_us();
+    fat16_create(&ctx, src, name);
+    series_add(&s_create, now_us() - t);
+    s_create.bytes += src_len;
+  }
+  for (uint32_t i = 0; i < rounds; i++) {
+    snprintf(name, sizeof(name), "B%05u.TMP", i);
+    snprintf(other, sizeof(other), "R%05u.TMP", i);
+    t = now_us();
+    fat16_rename(&ctx, name, other);
+    series_add(&s_ren, now_us() - t);
+  }
+  for (uint32_t i = 0; i < rounds; i++) {
+    snprintf(other, sizeof(other), "R%05u.TMP", i);
+    t = now_us();
+    fat16_delete(&ctx, other);
+    series_add(&s_del, now_us() - t);
+  }
+  fat16_close(&ctx);
+  unlink(src);
+  free(buf);
+  quiet(0);
+
+  printf("%-8s %6s %10s %10s %10s %10s %10s %9s\n", "op", "n", "p50(us)",
+         "p90(us)", "p99(us)", "max(us)", "ops/s", "MiB/s");
+  series_report(&s_open);
+  series_report(&s_list);
+  series_report(&s_look);
+  series_report(&s_read);
+  series_report(&s_create);
+  series_report(&s_ren);
+  series_report(&s_del);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  BenchCfg cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.size_mb = 32;
+  cfg.bps = 512;
+  cfg.spc = 4;
+  cfg.root = 512;
+  cfg.fill = 50;
+  cfg.iters = 200;
+  cfg.seed = 1;
+  snprintf(cfg.img, sizeof(cfg.img), "build/bench.img");
+
+  for (int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    const char *v = strchr(a, '=');
+    uint32_t n = v ? (uint32_t)strtoul(v + 1, NULL, 10) : 0;
+    if (strncmp(a, "--size=", 7) == 0)
+      cfg.size_mb = n;
+    else if (strncmp(a, "--bps=", 6) == 0)
+      cfg.bps = n;
+    else if (strncmp(a, "--spc=", 6) == 0)
+      cfg.spc = n;
+    else if (strncmp(a, "--root=", 7) == 0)
+      cfg.root = n;
+    else if (strncmp(a, "--fill=", 7) == 0)
+      cfg.fill = n > 100 ? 100 : n;
+    else if (strncmp(a, "--frag=", 7) == 0)
+      cfg.frag = n > 100 ? 100 : n;
+    else if (strncmp(a, "--iters=", 8) == 0)
+      cfg.iters = n;
+    else if (strncmp(a, "--seed=", 7) == 0)
+      cfg.seed = n;
+    else if (strncmp(a, "--img=", 6) == 0)
+      snprintf(cfg.img, sizeof(cfg.img), "%s", v + 1);
+    else if (strcmp(a, "--mmap") == 0)
+      cfg.opts.flags |= FAT16_OPEN_MMAP;
+    else if (strncmp(a, "--cache=", 8) == 0)
+      cfg.opts.cache_blocks = n;
+    else if (strcmp(a, "--uring") == 0)
+      cfg.opts.flags |= FAT16_OPEN_URING;
+    else if (strcmp(a, "--sparse") == 0)
+      cfg.opts.flags |= FAT16_OPEN_SPARSE;
+    else if (strcmp(a, "--lazy") == 0)
+      cfg.opts.flags |= FAT16_OPEN_LAZY;
+    else {
+      printf("Opção inválida: '%s'.\n", a);
+      return 1;
+    }
+  }
+  if (cfg.bps < 512 || cfg.bps > 4096 || (cfg.bps & (cfg.bps - 1)) ||
+      cfg.spc == 0 || cfg.spc > 128 || (cfg.spc & (cfg.spc - 1)) ||
+      cfg.root == 0 || cfg.iters == 0) {
+    printf("Parâmetros inválidos.\n");
+    return 1;
+  }
+  rng_state = cfg.seed ? cfg.seed : 1;
+
+  int nfiles = make_image(&cfg);
+  if (nfiles < 0)
+    return 1;
+  printf("\n== %u MiB, %u B/setor, %u setor(es)/cluster, raiz %u, "
+         "ocupação %u%%, fragmentação %u%% (%d arquivos, varredura %s)\n",
+         cfg.size_mb, cfg.bps, cfg.spc, cfg.root, cfg.fill, cfg.frag,
+         nfiles, fat16_scan_impl());
+  int rc = run_bench(&cfg, nfiles);
+  unlink(cfg.img);
+  return rc;
+}
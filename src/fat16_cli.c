@@ -1,5 +1,7 @@
 #include "fat16.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 static void menu(void) {
   printf("\n");
@@ -12,28 +14,266 @@ static void menu(void) {
   printf("║ 4. Renomear arquivo                          ║\n");
   printf("║ 5. Remover arquivo                           ║\n");
   printf("║ 6. Inserir novo arquivo                      ║\n");
+  printf("║ 7. Listar subdiretório (caminho)             ║\n");
+  printf("║ 8. Estatísticas do cache                     ║\n");
+  printf("║ 9. Verificar consistência (fsck)             ║\n");
+  printf("║ 10. Estatísticas de E/S e latência           ║\n");
   printf("║ 0. Sair                                      ║\n");
   printf("╚══════════════════════════════════════════════╝\n");
   printf("Escolha: ");
 }
 
+static void usage(const char *prog) {
+  printf("Uso: %s [opções] [imagem [comando args...]]\n", prog);
+  printf("  --mmap                  acessa a imagem por mmap (sem cópias na "
+         "leitura)\n");
+  printf("  --cache=N               cache de N blocos (setores) com "
+         "write-back\n");
+  printf("  --cache-policy=lru|clock  política de substituição do cache\n");
+  printf("  --uring[=N]             E/S de clusters em lote via io_uring "
+         "(fila de N, padrão 64)\n");
+  printf("  --sparse                devolve ao host o espaço de clusters "
+         "apagados ou zerados\n");
+  printf("  --overlay[=DELTA]       não altera a imagem: escritas vão para "
+         "DELTA (ou memória)\n");
+  printf("  --no-kcopy              import copia os dados por buffer (sem "
+         "copy_file_range/sendfile)\n");
+  printf("  --lazy                  abre lendo só o boot; FAT e raiz sob "
+         "demanda\n");
+  printf("  --quiet                 não mostra o resumo do volume ao "
+         "abrir\n");
+  printf("  --journal[=N]           metadados via journal, commit a cada N "
+         "operações (padrão 64)\n");
+  printf("  --stats-json=ARQ        grava contadores e latências em JSON ao "
+         "sair (- → saída padrão)\n");
+  printf("Comandos (sem menu):\n");
+  printf("  import origem[=NOME.EXT]...  importa arquivos do host em lote\n");
+  printf("  check [--repair] [--threads=N]  verifica (e corrige) o volume\n");
+  printf("  defrag [--dry-run]           deixa contígua a cadeia de cada "
+         "arquivo\n");
+  printf("  extract DIR                  copia o volume inteiro para DIR "
+         "(leitura sequencial)\n");
+  printf("  overlay-commit               aplica o delta do --overlay na "
+         "imagem\n");
+  printf("  write NOME OFFSET origem     grava origem no arquivo a partir "
+         "de OFFSET\n");
+  printf("  append NOME origem           acrescenta origem ao fim do "
+         "arquivo\n");
+  printf("  truncate NOME TAMANHO        corta ou estende (com zeros) o "
+         "arquivo\n");
+}
+
+/* import origem[=NOME.EXT]... : cópia em lote com um único commit. */
+static int cmd_import(Fat16Ctx *ctx, int argc, char *argv[]) {
+  const char **hosts = (const char **)malloc(sizeof(char *) * (size_t)argc);
+  const char **dests = (const char **)malloc(sizeof(char *) * (size_t)argc);
+  if (!hosts || !dests) {
+    free(hosts);
+    free(dests);
+    return 1;
+  }
+  for (int i = 0; i < argc; i++) {
+    char *eq = strrchr(argv[i], '=');
+    if (eq)
+      *eq = '\0';
+    hosts[i] = argv[i];
+    dests[i] = eq ? eq + 1 : NULL;
+  }
+  int ok = fat16_import_batch(ctx, hosts, dests, argc);
+  free(hosts);
+  free(dests);
+  return (ok == argc) ? 0 : 1;
+}
+
+/* check [--repair] [--threads=N]: sai com 0 se o volume está consistente
+ * (ou se todos os problemas foram corrigidos). */
+static int cmd_check(Fat16Ctx *ctx, int argc, char *argv[]) {
+  unsigned flags = 0;
+  int threads = 0;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "--repair") == 0) {
+      flags |= FAT16_CHECK_REPAIR;
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      threads = atoi(argv[i] + 10);
+    } else {
+      printf("Argumento inválido: '%s'.\n", argv[i]);
+      return 1;
+    }
+  }
+  int r = fat16_check(ctx, flags, threads, NULL);
+  if (r < 0)
+    return 1;
+  return (r == 0 || (flags & FAT16_CHECK_REPAIR)) ? 0 : 1;
+}
+
+/* defrag [--dry-run]: com --dry-run só mostra o relatório. */
+static int cmd_defrag(Fat16Ctx *ctx, int argc, char *argv[]) {
+  unsigned flags = 0;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "--dry-run") == 0) {
+      flags |= FAT16_DEFRAG_DRY_RUN;
+    } else {
+      printf("Argumento inválido: '%s'.\n", argv[i]);
+      return 1;
+    }
+  }
+  return fat16_defrag(ctx, flags, NULL) ? 0 : 1;
+}
+
+/* Lê um arquivo do host inteiro para a memória (*len bytes). */
+static void *read_host(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    printf("Não consegui abrir '%s'.\n", path);
+    return NULL;
+  }
+  size_t cap = 0, n = 0;
+  char *buf = NULL;
+  for (;;) {
+    if (n == cap) {
+      cap = cap ? cap * 2 : 65536;
+      char *p = (char *)realloc(buf, cap);
+      if (!p) {
+        free(buf);
+        fclose(f);
+        return NULL;
+      }
+      buf = p;
+    }
+    size_t r = fread(buf + n, 1, cap - n, f);
+    if (r == 0)
+      break;
+    n += r;
+  }
+  fclose(f);
+  *len = n;
+  return buf;
+}
+
+/* write NOME OFFSET origem / append NOME origem: alteração no lugar. */
+static int cmd_write(Fat16Ctx *ctx, const char *name, const char *offset,
+                     const char *src) {
+  size_t len;
+  void *buf = read_host(src, &len);
+  if (!buf)
+    return 1;
+  long r = offset ? fat16_write_at(ctx, name,
+                                   (uint32_t)strtoul(offset, NULL, 10), buf,
+                                   len)
+                  : fat16_append(ctx, name, buf, len);
+  free(buf);
+  if (r < 0)
+    return 1;
+  printf("Gravados %ld bytes em '%s'.\n", r, name);
+  return 0;
+}
+
+/* Grava as estatísticas em JSON (json == NULL → nada a fazer). */
+static void dump_stats(Fat16Ctx *ctx, const char *json) {
+  if (!json)
+    return;
+  FILE *f = strcmp(json, "-") == 0 ? stdout : fopen(json, "w");
+  if (!f || !fat16_stats_json(ctx, f))
+    printf("Não consegui gravar as estatísticas em '%s'.\n", json);
+  if (f && f != stdout)
+    fclose(f);
+}
+
+/* Executa um comando não interativo; retorna o código de saída. */
+static int run_command(Fat16Ctx *ctx, const char *cmd, int argc, char *argv[]) {
+  if (strcmp(cmd, "import") == 0 && argc > 0)
+    return cmd_import(ctx, argc, argv);
+  if (strcmp(cmd, "check") == 0)
+    return cmd_check(ctx, argc, argv);
+  if (strcmp(cmd, "defrag") == 0)
+    return cmd_defrag(ctx, argc, argv);
+  if (strcmp(cmd, "extract") == 0 && argc == 1)
+    return fat16_extract(ctx, argv[0], NULL) ? 0 : 1;
+  if (strcmp(cmd, "overlay-commit") == 0 && argc == 0)
+    return fat16_overlay_commit(ctx) ? 0 : 1;
+  if (strcmp(cmd, "write") == 0 && argc == 3)
+    return cmd_write(ctx, argv[0], argv[1], argv[2]);
+  if (strcmp(cmd, "append") == 0 && argc == 2)
+    return cmd_write(ctx, argv[0], NULL, argv[1]);
+  if (strcmp(cmd, "truncate") == 0 && argc == 2)
+    return fat16_truncate(ctx, argv[0], (uint32_t)strtoul(argv[1], NULL, 10))
+               ? 0
+               : 1;
+  printf("Comando inválido: '%s'.\n", cmd);
+  return 1;
+}
+
 int main(int argc, char *argv[]) {
   Fat16Ctx ctx;
-  char path[512];
+  Fat16Options opts = {0};
+  char path[512] = "";
+  int cmd = 0; /* índice do comando em argv (0 → menu interativo) */
+  const char *stats_json = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--mmap") == 0) {
+      opts.flags |= FAT16_OPEN_MMAP;
+    } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+      opts.cache_blocks = (uint32_t)strtoul(argv[i] + 8, NULL, 10);
+    } else if (strcmp(argv[i], "--cache-policy=clock") == 0) {
+      opts.cache_policy = FAT16_CACHE_CLOCK;
+    } else if (strcmp(argv[i], "--cache-policy=lru") == 0) {
+      opts.cache_policy = FAT16_CACHE_LRU;
+    } else if (strcmp(argv[i], "--sparse") == 0) {
+      opts.flags |= FAT16_OPEN_SPARSE;
+    } else if (strcmp(argv[i], "--overlay") == 0) {
+      opts.flags |= FAT16_OPEN_OVERLAY;
+    } else if (strncmp(argv[i], "--overlay=", 10) == 0) {
+      opts.flags |= FAT16_OPEN_OVERLAY;
+      opts.overlay_path = argv[i] + 10;
+    } else if (strcmp(argv[i], "--no-kcopy") == 0) {
+      opts.flags |= FAT16_OPEN_NO_KCOPY;
+    } else if (strcmp(argv[i], "--lazy") == 0) {
+      opts.flags |= FAT16_OPEN_LAZY;
+    } else if (strcmp(argv[i], "--quiet") == 0) {
+      opts.flags |= FAT16_OPEN_QUIET;
+    } else if (strcmp(argv[i], "--uring") == 0) {
+      opts.flags |= FAT16_OPEN_URING;
+    } else if (strncmp(argv[i], "--uring=", 8) == 0) {
+      opts.flags |= FAT16_OPEN_URING;
+      opts.uring_depth = (uint32_t)strtoul(argv[i] + 8, NULL, 10);
+    } else if (strcmp(argv[i], "--journal") == 0) {
+      opts.flags |= FAT16_OPEN_JOURNAL;
+    } else if (strncmp(argv[i], "--journal=", 10) == 0) {
+      opts.flags |= FAT16_OPEN_JOURNAL;
+      opts.journal_ops = (uint32_t)strtoul(argv[i] + 10, NULL, 10);
+    } else if (strncmp(argv[i], "--stats-json=", 13) == 0) {
+      stats_json = argv[i] + 13;
+    } else if (strncmp(argv[i], "--", 2) == 0) {
+      usage(argv[0]);
+      return 1;
+    } else {
+      snprintf(path, sizeof(path), "%s", argv[i]);
+      if (i + 1 < argc)
+        cmd = i + 1;
+      break;
+    }
+  }
 
-  printf("FAT16 — MENU\n");
+  if (cmd == 0)
+    printf("FAT16 — MENU\n");
 
-  if (argc > 1) {
-    snprintf(path, sizeof(path), "%s", argv[1]);
-  } else {
+  if (path[0] == '\0') {
     printf("Caminho da imagem FAT16: ");
     if (scanf("%511s", path) != 1)
       return 1;
   }
 
-  if (!fat16_open(&ctx, path))
+  if (!fat16_open_ex(&ctx, path, &opts))
     return 1;
 
+  if (cmd != 0) {
+    int rc = run_command(&ctx, argv[cmd], argc - cmd - 1, argv + cmd + 1);
+    dump_stats(&ctx, stats_json);
+    fat16_close(&ctx);
+    return rc;
+  }
+
   int opt;
   char a[256], b[256], src[512];
   for (;;) { // laço infinito
@@ -91,13 +331,48 @@ int main(int argc, char *argv[]) {
         break;
       fat16_create(&ctx, src, a);
       break;
+    case 7:
+      printf("Caminho do diretório (ex.: PASTA/SUB): ");
+      if (scanf("%255s", a) != 1)
+        break;
+      fat16_list_path(&ctx, a);
+      break;
+    case 8: {
+      Fat16CacheStats st;
+      fat16_cache_stats(&ctx, &st);
+      if (st.blocks == 0) {
+        printf("Cache desligado (use --cache=N).\n");
+        break;
+      }
+      uint64_t total = st.hits + st.misses;
+      printf("Cache: %u blocos de %u bytes, %u sujo(s)\n", st.blocks,
+             st.block_size, st.dirty);
+      printf("Acertos: %llu  Faltas: %llu  (%.1f%% de acerto)\n",
+             (unsigned long long)st.hits, (unsigned long long)st.misses,
+             total ? 100.0 * (double)st.hits / (double)total : 0.0);
+      printf("Blocos gravados (write-back): %llu\n",
+             (unsigned long long)st.writebacks);
+      break;
+    }
+    case 9:
+      printf("Corrigir o que encontrar? (s/n): ");
+      if (scanf("%255s", a) != 1)
+        break;
+      fat16_check(&ctx, (a[0] == 's' || a[0] == 'S') ? FAT16_CHECK_REPAIR : 0,
+                  0, NULL);
+      break;
+    case 10:
+      fat16_show_stats(&ctx);
+      break;
     case 0:
+      dump_stats(&ctx, stats_json);
       fat16_close(&ctx);
       return 0;
     default:
       printf("Opção inválida.\n");
     }
   }
+  dump_stats(&ctx, stats_json);
   fat16_close(&ctx);
   return 0;
 }
@@ -0,0 +1,372 @@
+/*
+ * fat16c — cliente do fat16d: manda pedidos pelo socket Unix e imprime as
+ * respostas. Não abre a imagem nem liga com a biblioteca.
+ *
+ * Uso: fat16c [--vol=N] SOCKET comando [args...]
+ *      fat16c [--vol=N] SOCKET -        (comandos da entrada padrão)
+ *
+ * Comandos: ls [CAMINHO], stat CAMINHO, cat CAMINHO, put ORIGEM [NOME],
+ * mv ANTIGO NOVO, rm NOME, flush, shutdown. Com "-", todos os comandos
+ * (um por linha) seguem em pipeline, sem esperar cada resposta, e as saídas
+ * são impressas na ordem; cada cat lê até 16 MiB.
+ */
+#include "fat16.h"
+#include "fat16_proto.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Pedido montado (cabeçalho + payload), pronto para envio. */
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+} Frame;
+
+static int sock_fd = -1;
+static uint8_t vol;
+
+static int frame_new(Frame *f, uint8_t op, uint32_t id, size_t payload) {
+  f->len = sizeof(Fat16Req) + payload;
+  f->buf = (uint8_t *)malloc(f->len);
+  if (!f->buf)
+    return 0;
+  Fat16Req rq = {(uint32_t)payload, op, vol, 0, id};
+  memcpy(f->buf, &rq, sizeof(rq));
+  return 1;
+}
+
+static uint8_t *payload(Frame *f) { return f->buf + sizeof(Fat16Req); }
+
+/* Lê um arquivo do host inteiro para a memória. */
+static uint8_t *read_host(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    printf("Não consegui abrir '%s'.\n", path);
+    return NULL;
+  }
+  size_t cap = 65536, n = 0;
+  uint8_t *buf = (uint8_t *)malloc(cap);
+  while (buf) {
+    n += fread(buf + n, 1, cap - n, f);
+    if (n < cap)
+      break;
+    uint8_t *p = (uint8_t *)realloc(buf, cap * 2);
+    if (!p) {
+      free(buf);
+      buf = NULL;
+      break;
+    }
+    buf = p;
+    cap *= 2;
+  }
+  fclose(f);
+  *len = n;
+  return buf;
+}
+
+/* Monta o pedido de um comando (argv[0] é o nome); retorna 0 se inválido. */
+static int build(Frame *f, int argc, char *argv[], uint32_t id,
+                 uint32_t read_off) {
+  const char *cmd = argv[0];
+  if (strcmp(cmd, "ls") == 0 && argc <= 2) {
+    const char *p = argc == 2 ? argv[1] : "";
+    if (!frame_new(f, FAT16_P_LIST, id, strlen(p)))
+      return 0;
+    memcpy(payload(f), p, strlen(p));
+    return 1;
+  }
+  if ((strcmp(cmd, "stat") == 0 || strcmp(cmd, "rm") == 0) && argc == 2) {
+    size_t n = strlen(argv[1]);
+    if (!frame_new(f, cmd[0] == 's' ? FAT16_P_STAT : FAT16_P_DELETE, id, n))
+      return 0;
+    memcpy(payload(f), argv[1], n);
+    return 1;
+  }
+  if (strcmp(cmd, "cat") == 0 && argc == 2) {
+    size_t n = strlen(argv[1]);
+    uint32_t want = FAT16_PROTO_MAX;
+    if (!frame_new(f, FAT16_P_READ, id, 8 + n))
+      return 0;
+    memcpy(payload(f), &read_off, 4);
+    memcpy(payload(f) + 4, &want, 4);
+    memcpy(payload(f) + 8, argv[1], n);
+    return 1;
+  }
+  if ((strcmp(cmd, "put") == 0 && (argc == 2 || argc == 3)) ||
+      (strcmp(cmd, "mv") == 0 && argc == 3)) {
+    const char *name = argv[argc - 1];
+    const uint8_t *rest = (const uint8_t *)argv[1];
+    size_t rest_len = strlen(argv[1]);
+    uint8_t *data = NULL;
+    if (cmd[0] == 'p') {
+      if (argc == 2) {
+        const char *base = strrchr(argv[1], '/');
+        name = base ? base + 1 : argv[1];
+      }
+      data = read_host(argv[1], &rest_len);
+      if (!data)
+        return 0;
+      rest = data;
+    } else {
+      name = argv[1];
+      rest = (const uint8_t *)argv[2];
+      rest_len = strlen(argv[2]);
+    }
+    uint16_t n = (uint16_t)strlen(name);
+    int ok = rest_len <= FAT16_PROTO_MAX &&
+             frame_new(f, cmd[0] == 'p' ? FAT16_P_CREATE : FAT16_P_RENAME, id,
+                       2 + n + rest_len);
+    if (ok) {
+      memcpy(payload(f), &n, 2);
+      memcpy(payload(f) + 2, name, n);
+      memcpy(payload(f) + 2 + n, rest, rest_len);
+    } else if (rest_len > FAT16_PROTO_MAX) {
+      printf("'%s' passa de 16 MiB.\n", argv[1]);
+    }
+    free(data);
+    return ok;
+  }
+  if (strcmp(cmd, "flush") == 0 && argc == 1)
+    return frame_new(f, FAT16_P_FLUSH, id, 0);
+  if (strcmp(cmd, "shutdown") == 0 && argc == 1)
+    return frame_new(f, FAT16_P_SHUTDOWN, id, 0);
+  printf("Comando inválido: '%s'.\n", cmd);
+  return 0;
+}
+
+static const char *status_msg(int st) {
+  switch (st) {
+  case FAT16_P_NOENT:
+    return "não encontrado";
+  case FAT16_P_FAIL:
+    return "operação falhou (veja o log do fat16d)";
+  case FAT16_P_BADREQ:
+    return "pedido inválido";
+  case FAT16_P_BADVOL:
+    return "volume inexistente";
+  }
+  return "erro";
+}
+
+static void print_name(const DirectoryEntry *e) {
+  char nm[13];
+  int k = 0;
+  for (int i = 0; i < 8 && e->filename[i] != ' '; i++)
+    nm[k++] = e->filename[i];
+  if (e->extension[0] != ' ') {
+    nm[k++] = '.';
+    for (int i = 0; i < 3 && e->extension[i] != ' '; i++)
+      nm[k++] = e->extension[i];
+  }
+  nm[k] = '\0';
+  if (e->attributes & ATTR_DIRECTORY)
+    printf("%-13s %12s\n", nm, "<DIR>");
+  else
+    printf("%-13s %12lu\n", nm, (unsigned long)e->file_size);
+}
+
+/* Imprime a resposta rs (payload em p); retorna 0 se foi erro. */
+static int show(const Fat16Resp *rs, const uint8_t *p) {
+  if (rs->status != FAT16_P_OK) {
+    printf("Erro: %s.\n", status_msg(rs->status));
+    return 0;
+  }
+  switch (rs->op) {
+  case FAT16_P_LIST:
+    for (uint32_t i = 0; i + sizeof(DirectoryEntry) <= rs->len;
+         i += sizeof(DirectoryEntry))
+      print_name((const DirectoryEntry *)(p + i));
+    break;
+  case FAT16_P_STAT: {
+    const DirectoryEntry *e = (const DirectoryEntry *)p;
+    print_name(e);
+    printf("Atributos: 0x%02x  1º cluster: %u\n", e->attributes,
+           e->first_cluster_low);
+    break;
+  }
+  case FAT16_P_READ:
+    fwrite(p, 1, rs->len, stdout);
+    break;
+  default:
+    printf("OK\n");
+  }
+  return 1;
+}
+
+/* Lê exatamente len bytes do socket. */
+static int recv_all(void *buf, size_t len) {
+  uint8_t *b = (uint8_t *)buf;
+  while (len > 0) {
+    ssize_t r = recv(sock_fd, b, len, 0);
+    if (r <= 0) {
+      if (r < 0 && errno == EINTR)
+        continue;
+      return 0;
+    }
+    b += r;
+    len -= (size_t)r;
+  }
+  return 1;
+}
+
+static int recv_resp(Fat16Resp *rs, uint8_t **p) {
+  if (!recv_all(rs, sizeof(*rs)))
+    return 0;
+  *p = (uint8_t *)malloc(rs->len ? rs->len : 1);
+  return *p && recv_all(*p, rs->len);
+}
+
+/* Um comando só: cat repete READ até o fim do arquivo. */
+static int run_one(int argc, char *argv[]) {
+  uint32_t off = 0;
+  for (;;) {
+    Frame f;
+    if (!build(&f, argc, argv, 1, off))
+      return 1;
+    int sent = send(sock_fd, f.buf, f.len, MSG_NOSIGNAL) == (ssize_t)f.len;
+    free(f.buf);
+    Fat16Resp rs;
+    uint8_t *p = NULL;
+    if (!sent || !recv_resp(&rs, &p)) {
+      printf("Conexão com o fat16d perdida.\n");
+      free(p);
+      return 1;
+    }
+    int ok = show(&rs, p);
+    free(p);
+    if (!ok)
+      return 1;
+    if (rs.op != FAT16_P_READ || rs.len < FAT16_PROTO_MAX)
+      return 0;
+    off += rs.len;
+  }
+}
+
+/*
+ * Pipeline: os pedidos de todas as linhas da entrada são enviados sem
+ * esperar as respostas, e o mesmo laço as recebe conforme chegam; poll
+ * evita que cliente e daemon esperem um pelo outro com os buffers cheios.
+ */
+static int run_batch(void) {
+  char line[1024];
+  uint32_t sent = 0, done = 0;
+  int rc = 0, more = 1;
+  Frame f = {NULL, 0};
+  size_t f_off = 0;
+  Fat16Resp rs;
+  size_t rs_got = 0;
+  uint8_t *p = NULL;
+  size_t p_got = 0;
+
+  while (more || f.buf || done < sent) {
+    /* próximo pedido a enviar */
+    while (more && !f.buf) {
+      if (!fgets(line, sizeof(line), stdin)) {
+        more = 0;
+        shutdown(sock_fd, SHUT_WR);
+        break;
+      }
+      char *argv[8];
+      int argc = 0;
+      for (char *t = strtok(line, " \t\r\n"); t && argc < 8;
+           t = strtok(NULL, " \t\r\n"))
+        argv[argc++] = t;
+      if (argc == 0)
+        continue;
+      if (build(&f, argc, argv, sent + 1, 0)) {
+        f_off = 0;
+        sent++;
+      } else {
+        rc = 1;
+      }
+    }
+    struct pollfd pfd = {sock_fd, (short)(POLLIN | (f.buf ? POLLOUT : 0)), 0};
+    if (poll(&pfd, 1, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      return 1;
+    }
+    if ((pfd.revents & POLLOUT) && f.buf) {
+      ssize_t w = send(sock_fd, f.buf + f_off, f.len - f_off,
+                       MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (w > 0)
+        f_off += (size_t)w;
+      if (f_off == f.len) {
+        free(f.buf);
+        f.buf = NULL;
+      }
+    }
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t r;
+      if (rs_got < sizeof(rs))
+        r = recv(sock_fd, (uint8_t *)&rs + rs_got, sizeof(rs) - rs_got,
+                 MSG_DONTWAIT);
+      else
+        r = recv(sock_fd, p + p_got, rs.len - p_got, MSG_DONTWAIT);
+      if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) {
+        printf("Conexão com o fat16d perdida.\n");
+        free(f.buf);
+        free(p);
+        return 1;
+      }
+      if (r > 0 && rs_got < sizeof(rs)) {
+        rs_got += (size_t)r;
+        if (rs_got == sizeof(rs)) {
+          p = (uint8_t *)malloc(rs.len ? rs.len : 1);
+          p_got = 0;
+          if (!p)
+            return 1;
+        }
+      } else if (r > 0) {
+        p_got += (size_t)r;
+      }
+      if (rs_got == sizeof(rs) && p_got == rs.len) {
+        if (!show(&rs, p))
+          rc = 1;
+        free(p);
+        p = NULL;
+        rs_got = 0;
+        done++;
+      }
+    }
+  }
+  return rc;
+}
+
+int main(int argc, char *argv[]) {
+  int i = 1;
+  if (i < argc && strncmp(argv[i], "--vol=", 6) == 0)
+    vol = (uint8_t)atoi(argv[i++] + 6);
+  if (argc - i < 2) {
+    printf("Uso: %s [--vol=N] SOCKET comando [args...] | -\n", argv[0]);
+    printf("Comandos: ls [CAMINHO], stat CAMINHO, cat CAMINHO, "
+           "put ORIGEM [NOME], mv ANTIGO NOVO, rm NOME, flush, shutdown\n");
+    return 1;
+  }
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", argv[i]);
+  sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock_fd < 0 ||
+      connect(sock_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    printf("Não consegui conectar em '%s'.\n", argv[i]);
+    return 1;
+  }
+  i++;
+  if (strncmp(argv[i], "--vol=", 6) == 0) { /* também aceito depois do socket */
+    vol = (uint8_t)atoi(argv[i++] + 6);
+    if (i == argc) {
+      printf("Falta o comando.\n");
+      return 1;
+    }
+  }
+  int rc = strcmp(argv[i], "-") == 0 ? run_batch()
+                                     : run_one(argc - i, argv + i);
+  close(sock_fd);
+  return rc;
+}
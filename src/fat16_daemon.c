@@ -0,0 +1,437 @@
+/*
+ * fat16d — mantém uma ou mais imagens FAT16 abertas (FAT, raiz e caches já
+ * carregados) e atende pedidos de clientes num socket Unix, no protocolo de
+ * fat16_proto.h. Evita que scripts com milhares de operações pequenas
+ * paguem fat16_open a cada uma.
+ *
+ * Uso: fat16d [--mmap] [--cache=N] [--uring[=N]] [--sparse] [--journal[=N]]
+ *             [--lazy] [--quiet] SOCKET imagem [imagem...]
+ *
+ * Um só processo, laço com poll: cada conexão tem buffers de entrada e
+ * saída; todos os pedidos completos que chegaram são executados em ordem e
+ * as respostas acumuladas são enviadas juntas. SHUTDOWN, SIGINT ou SIGTERM
+ * fecham os volumes (gravando o que estiver pendente) e removem o socket.
+ * As mensagens da biblioteca vão para a saída padrão (--quiet descarta).
+ */
+#include "fat16.h"
+#include "fat16_proto.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_CLIENTS 64
+#define MAX_VOLS 16
+/* Contrapressão: com mais que OUT_HIGH bytes de respostas ainda não
+ * enviadas, a conexão deixa de ler e de executar pedidos até o cliente
+ * consumir a saída. A entrada guarda no máximo um quadro do maior tamanho
+ * (mais a folga de uma leitura). */
+#define OUT_HIGH (4u << 20)
+#define IN_HIGH (sizeof(Fat16Req) + FAT16_PROTO_MAX + 512 + 65536)
+
+typedef struct {
+  int fd;
+  uint8_t *in;
+  size_t in_len, in_cap;
+  uint8_t *out;
+  size_t out_len, out_off, out_cap;
+  int eof; /* cliente fechou a escrita: só falta enviar as respostas */
+} Conn;
+
+static Fat16Ctx vols[MAX_VOLS];
+static int nvols;
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+static int buf_reserve(uint8_t **buf, size_t *cap, size_t need) {
+  if (need <= *cap)
+    return 1;
+  size_t ncap = *cap ? *cap : 65536;
+  while (ncap < need)
+    ncap *= 2;
+  uint8_t *p = (uint8_t *)realloc(*buf, ncap);
+  if (!p)
+    return 0;
+  *buf = p;
+  *cap = ncap;
+  return 1;
+}
+
+/* Acrescenta uma resposta (cabeçalho + payload) à saída da conexão. */
+static int reply(Conn *c, const Fat16Req *rq, int status, const void *data,
+                 size_t len) {
+  Fat16Resp rs;
+  rs.len = (uint32_t)len;
+  rs.status = (uint8_t)status;
+  rs.op = rq->op;
+  rs.reserved = 0;
+  rs.id = rq->id;
+  if (!buf_reserve(&c->out, &c->out_cap, c->out_len + sizeof(rs) + len))
+    return 0;
+  memcpy(c->out + c->out_len, &rs, sizeof(rs));
+  if (len)
+    memcpy(c->out + c->out_len + sizeof(rs), data, len);
+  c->out_len += sizeof(rs) + len;
+  return 1;
+}
+
+/* Copia n bytes de p para uma string terminada (nomes e caminhos). */
+static int take_str(const uint8_t *p, size_t n, char *dst, size_t cap) {
+  if (n >= cap || memchr(p, '\0', n))
+    return 0;
+  memcpy(dst, p, n);
+  dst[n] = '\0';
+  return 1;
+}
+
+static int do_list(Conn *c, const Fat16Req *rq, Fat16Ctx *ctx,
+                   const char *path) {
+  int n = fat16_readdir(ctx, path, NULL, 0);
+  if (n < 0)
+    return reply(c, rq, FAT16_P_NOENT, NULL, 0);
+  DirectoryEntry *ents =
+      (DirectoryEntry *)malloc(sizeof(DirectoryEntry) * (size_t)(n + 1));
+  if (!ents)
+    return reply(c, rq, FAT16_P_FAIL, NULL, 0);
+  /* a pasta não muda entre as duas chamadas: o daemon é o único escritor */
+  n = fat16_readdir(ctx, path, ents, n + 1);
+  int ok = reply(c, rq, FAT16_P_OK, ents, sizeof(DirectoryEntry) * (size_t)n);
+  free(ents);
+  return ok;
+}
+
+static int do_read(Conn *c, const Fat16Req *rq, Fat16Ctx *ctx,
+                   const uint8_t *p) {
+  uint32_t off, len;
+  char path[256];
+  memcpy(&off, p, 4);
+  memcpy(&len, p + 4, 4);
+  if (!take_str(p + 8, rq->len - 8, path, sizeof(path)))
+    return reply(c, rq, FAT16_P_BADREQ, NULL, 0);
+  DirectoryEntry e;
+  if (!fat16_lookup_path(ctx, path, &e) || (e.attributes & ATTR_DIRECTORY))
+    return reply(c, rq, FAT16_P_NOENT, NULL, 0);
+  if (len > FAT16_PROTO_MAX)
+    len = FAT16_PROTO_MAX;
+  if (off >= e.file_size)
+    len = 0;
+  else if (len > e.file_size - off)
+    len = e.file_size - off;
+  /* lê direto para a saída, depois do espaço do cabeçalho */
+  if (!buf_reserve(&c->out, &c->out_cap,
+                   c->out_len + sizeof(Fat16Resp) + len))
+    return reply(c, rq, FAT16_P_FAIL, NULL, 0);
+  uint8_t *dst = c->out + c->out_len + sizeof(Fat16Resp);
+  long got = len ? fat16_pread(ctx, &e, off, len, dst) : 0;
+  if (got < 0)
+    return reply(c, rq, FAT16_P_FAIL, NULL, 0);
+  Fat16Resp rs = {(uint32_t)got, FAT16_P_OK, rq->op, 0, rq->id};
+  memcpy(c->out + c->out_len, &rs, sizeof(rs));
+  c->out_len += sizeof(rs) + (size_t)got;
+  return 1;
+}
+
+/* Executa um pedido completo; retorna 0 se a conexão deve ser fechada. */
+static int handle(Conn *c, const Fat16Req *rq, const uint8_t *p) {
+  char a[256], b[256];
+  if (rq->op == FAT16_P_SHUTDOWN) {
+    stop = 1;
+    return reply(c, rq, FAT16_P_OK, NULL, 0);
+  }
+  if (rq->vol >= nvols)
+    return reply(c, rq, FAT16_P_BADVOL, NULL, 0);
+  Fat16Ctx *ctx = &vols[rq->vol];
+
+  switch (rq->op) {
+  case FAT16_P_LIST:
+    if (!take_str(p, rq->len, a, sizeof(a)))
+      break;
+    return do_list(c, rq, ctx, a);
+  case FAT16_P_STAT: {
+    DirectoryEntry e;
+    if (!take_str(p, rq->len, a, sizeof(a)))
+      break;
+    if (!fat16_lookup_path(ctx, a, &e))
+      return reply(c, rq, FAT16_P_NOENT, NULL, 0);
+    return reply(c, rq, FAT16_P_OK, &e, sizeof(e));
+  }
+  case FAT16_P_READ:
+    if (rq->len < 8)
+      break;
+    return do_read(c, rq, ctx, p);
+  case FAT16_P_CREATE:
+  case FAT16_P_RENAME: {
+    uint16_t n;
+    if (rq->len < 2)
+      break;
+    memcpy(&n, p, 2);
+    if ((size_t)n + 2 > rq->len || !take_str(p + 2, n, a, sizeof(a)))
+      break;
+    const uint8_t *rest = p + 2 + n;
+    size_t rest_len = rq->len - 2 - n;
+    int ok;
+    if (rq->op == FAT16_P_CREATE) {
+      ok = fat16_create_mem(ctx, a, rest, rest_len);
+    } else {
+      if (!take_str(rest, rest_len, b, sizeof(b)))
+        break;
+      ok = fat16_rename(ctx, a, b);
+    }
+    return reply(c, rq, ok ? FAT16_P_OK : FAT16_P_FAIL, NULL, 0);
+  }
+  case FAT16_P_DELETE:
+    if (!take_str(p, rq->len, a, sizeof(a)))
+      break;
+    if (!fat16_lookup(ctx, a))
+      return reply(c, rq, FAT16_P_NOENT, NULL, 0);
+    return reply(c, rq, fat16_delete(ctx, a) ? FAT16_P_OK : FAT16_P_FAIL,
+                 NULL, 0);
+  case FAT16_P_FLUSH:
+    return reply(c, rq, fat16_flush(ctx) ? FAT16_P_OK : FAT16_P_FAIL, NULL,
+                 0);
+  }
+  return reply(c, rq, FAT16_P_BADREQ, NULL, 0);
+}
+
+static int backlogged(const Conn *c) {
+  return c->out_len - c->out_off > OUT_HIGH;
+}
+
+/* Há um pedido completo (ou um quadro inválido) esperando em c->in? */
+static int has_request(const Conn *c) {
+  Fat16Req rq;
+  if (c->in_len < sizeof(rq))
+    return 0;
+  memcpy(&rq, c->in, sizeof(rq));
+  return rq.len > FAT16_PROTO_MAX + 512 || c->in_len >= sizeof(rq) + rq.len;
+}
+
+/* Executa os pedidos completos do buffer de entrada, até a saída passar de
+ * OUT_HIGH. */
+static int drain_input(Conn *c) {
+  size_t pos = 0;
+  while (c->in_len - pos >= sizeof(Fat16Req) && !backlogged(c)) {
+    Fat16Req rq;
+    memcpy(&rq, c->in + pos, sizeof(rq));
+    if (rq.len > FAT16_PROTO_MAX + 512)
+      return 0; /* quadro absurdo: o cliente não fala o protocolo */
+    if (c->in_len - pos < sizeof(rq) + rq.len)
+      break;
+    if (!handle(c, &rq, c->in + pos + sizeof(rq)))
+      return 0;
+    pos += sizeof(rq) + rq.len;
+  }
+  memmove(c->in, c->in + pos, c->in_len - pos);
+  c->in_len -= pos;
+  return 1;
+}
+
+/* Envia o que couber da saída; retorna 0 em erro. */
+static int flush_output(Conn *c) {
+  while (c->out_off < c->out_len) {
+    ssize_t w = send(c->fd, c->out + c->out_off, c->out_len - c->out_off,
+                     MSG_NOSIGNAL);
+    if (w < 0)
+      break;
+    c->out_off += (size_t)w;
+  }
+  if (c->out_off < c->out_len) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      return 0;
+    /* o já enviado sai da frente; sem isso out cresceria sem limite
+     * enquanto o cliente nunca esvazia a saída por completo */
+    if (c->out_off >= OUT_HIGH) {
+      memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+      c->out_len -= c->out_off;
+      c->out_off = 0;
+    }
+    return 1;
+  }
+  c->out_off = c->out_len = 0;
+  return 1;
+}
+
+static void conn_close(Conn *c) {
+  close(c->fd);
+  free(c->in);
+  free(c->out);
+  memset(c, 0, sizeof(*c));
+  c->fd = -1;
+}
+
+static void usage(const char *prog) {
+  printf("Uso: %s [--mmap] [--cache=N] [--uring[=N]] [--sparse] "
+         "[--journal[=N]] [--lazy] [--quiet] SOCKET imagem [imagem...]\n",
+         prog);
+}
+
+int main(int argc, char *argv[]) {
+  Fat16Options opts = {0};
+  int quiet = 0, i = 1;
+  for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+    if (strcmp(argv[i], "--mmap") == 0) {
+      opts.flags |= FAT16_OPEN_MMAP;
+    } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+      opts.cache_blocks = (uint32_t)strtoul(argv[i] + 8, NULL, 10);
+    } else if (strcmp(argv[i], "--uring") == 0) {
+      opts.flags |= FAT16_OPEN_URING;
+    } else if (strncmp(argv[i], "--uring=", 8) == 0) {
+      opts.flags |= FAT16_OPEN_URING;
+      opts.uring_depth = (uint32_t)strtoul(argv[i] + 8, NULL, 10);
+    } else if (strcmp(argv[i], "--sparse") == 0) {
+      opts.flags |= FAT16_OPEN_SPARSE;
+    } else if (strcmp(argv[i], "--journal") == 0) {
+      opts.flags |= FAT16_OPEN_JOURNAL;
+    } else if (strncmp(argv[i], "--journal=", 10) == 0) {
+      opts.flags |= FAT16_OPEN_JOURNAL;
+      opts.journal_ops = (uint32_t)strtoul(argv[i] + 10, NULL, 10);
+    } else if (strcmp(argv[i], "--lazy") == 0) {
+      opts.flags |= FAT16_OPEN_LAZY;
+    } else if (strcmp(argv[i], "--quiet") == 0) {
+      quiet = 1;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - i < 2 || argc - i - 1 > MAX_VOLS) {
+    usage(argv[0]);
+    return 1;
+  }
+  const char *sock_path = argv[i++];
+  if (quiet && !freopen("/dev/null", "w", stdout))
+    return 1;
+
+  for (; i < argc; i++) {
+    if (!fat16_open_ex(&vols[nvols], argv[i], &opts)) {
+      fprintf(stderr, "fat16d: não abri '%s'.\n", argv[i]);
+      while (nvols > 0)
+        fat16_close(&vols[--nvols]);
+      return 1;
+    }
+    nvols++;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "fat16d: caminho do socket longo demais.\n");
+    return 1;
+  }
+  strcpy(addr.sun_path, sock_path);
+  int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(sock_path);
+  if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(lfd, 16) != 0) {
+    fprintf(stderr, "fat16d: não consegui escutar em '%s': %s\n", sock_path,
+            strerror(errno));
+    while (nvols > 0)
+      fat16_close(&vols[--nvols]);
+    return 1;
+  }
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  signal(SIGPIPE, SIG_IGN);
+  fprintf(stderr, "fat16d: %d volume(s) em '%s'.\n", nvols, sock_path);
+
+  Conn conns[MAX_CLIENTS];
+  for (int k = 0; k < MAX_CLIENTS; k++)
+    conns[k].fd = -1;
+  struct pollfd pfd[MAX_CLIENTS + 1];
+
+  while (!stop) {
+    int np = 0;
+    pfd[np].fd = lfd;
+    pfd[np++].events = POLLIN;
+    for (int k = 0; k < MAX_CLIENTS; k++) {
+      if (conns[k].fd < 0)
+        continue;
+      pfd[np].fd = conns[k].fd;
+      pfd[np++].events =
+          (short)((conns[k].eof || backlogged(&conns[k]) ? 0 : POLLIN) |
+                  (conns[k].out_len > conns[k].out_off ? POLLOUT : 0));
+    }
+    if (poll(pfd, (nfds_t)np, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (pfd[0].revents & POLLIN) {
+      int cfd = accept(lfd, NULL, NULL);
+      int k = 0;
+      while (k < MAX_CLIENTS && conns[k].fd >= 0)
+        k++;
+      if (cfd >= 0 && k == MAX_CLIENTS) {
+        close(cfd); /* sem vaga */
+      } else if (cfd >= 0) {
+        fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+        memset(&conns[k], 0, sizeof(Conn));
+        conns[k].fd = cfd;
+      }
+    }
+    for (int q = 1; q < np; q++) {
+      Conn *c = NULL;
+      for (int k = 0; k < MAX_CLIENTS; k++)
+        if (conns[k].fd == pfd[q].fd)
+          c = &conns[k];
+      if (!c || !pfd[q].revents)
+        continue;
+      int alive = 1;
+      if (!c->eof && !backlogged(c) &&
+          (pfd[q].revents & (POLLIN | POLLHUP | POLLERR))) {
+        /* lê o que já chegou (até IN_HIGH) antes de executar: pedidos em
+         * pipeline viram um lote só de respostas */
+        while (c->in_len < IN_HIGH) {
+          if (!buf_reserve(&c->in, &c->in_cap, c->in_len + 65536)) {
+            alive = 0;
+            break;
+          }
+          ssize_t r = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, 0);
+          if (r > 0) {
+            c->in_len += (size_t)r;
+            continue;
+          }
+          if (r == 0)
+            c->eof = 1;
+          else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            alive = 0;
+          break;
+        }
+      }
+      /* pedidos já recebidos continuam sendo executados conforme a saída
+       * esvazia, mesmo sem dados novos do cliente */
+      alive = alive && drain_input(c) && flush_output(c);
+      while (alive && has_request(c) && !backlogged(c))
+        alive = drain_input(c) && flush_output(c);
+      /* com a escrita do cliente fechada, a conexão só termina depois de
+       * entregar as respostas */
+      if (!alive || (c->eof && c->out_len == 0 && !has_request(c)))
+        conn_close(c);
+    }
+  }
+
+  /* respostas pendentes (o OK do SHUTDOWN) antes de fechar */
+  for (int k = 0; k < MAX_CLIENTS; k++) {
+    if (conns[k].fd < 0)
+      continue;
+    fcntl(conns[k].fd, F_SETFL, fcntl(conns[k].fd, F_GETFL) & ~O_NONBLOCK);
+    flush_output(&conns[k]);
+    conn_close(&conns[k]);
+  }
+  close(lfd);
+  unlink(sock_path);
+  while (nvols > 0)
+    fat16_close(&vols[--nvols]);
+  fprintf(stderr, "fat16d: encerrado.\n");
+  return 0;
+}
@@ -1,581 +1,5388 @@
+#define _GNU_SOURCE /* fallocate, copy_file_range */
 #include "fat16.h"
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> /* kernels SSE2/AVX2 (escolhidos em tempo de execução) */
+#define SCAN_X86 1
+#endif
 
 /* ===== Helpers estáticos: visíveis apenas neste arquivo===== */
 
-static int load_boot(Fat16Ctx *ctx) {
-  if (fseek(ctx->img, 0, SEEK_SET) != 0)
-    return 0;
-  if (fread(&ctx->bpb, sizeof(BootSector), 1, ctx->img) != 1)
-    return 0;
-  return 1;
+/* ----- E/S da imagem: pread/pwrite (padrão) ou mapa de memória ----- */
+
+/* Atualiza map_size quando o arquivo cresceu por escritas fora do mapa.
+ * map_size é lido sem trava pelos leitores, por isso os acessos atômicos. */
+static void map_refresh(Fat16Ctx *ctx) {
+  struct stat st;
+  if (fstat(fileno(ctx->img), &st) != 0)
+    return;
+  size_t sz = (size_t)st.st_size;
+  __atomic_store_n(&ctx->map_size, (sz < ctx->map_len) ? sz : ctx->map_len,
+                   __ATOMIC_RELEASE);
 }
 
-static int load_fat(Fat16Ctx *ctx) {
-  ctx->fat_size_bytes =
-      (uint32_t)ctx->bpb.fat_size_16 * (uint32_t)ctx->bpb.bytes_per_sector;
-  ctx->fat = (uint16_t *)malloc(ctx->fat_size_bytes);
-  if (!ctx->fat)
-    return 0;
+static size_t map_avail(Fat16Ctx *ctx) {
+  return __atomic_load_n(&ctx->map_size, __ATOMIC_ACQUIRE);
+}
 
-  long fat0_off =
-      (long)ctx->bpb.reserved_sectors * (long)ctx->bpb.bytes_per_sector;
-  if (fseek(ctx->img, fat0_off, SEEK_SET) != 0)
-    return 0;
-  if (fread(ctx->fat, ctx->fat_size_bytes, 1, ctx->img) != 1)
-    return 0;
+/* Ponteiro para [off, off+len) dentro do mapa, ou NULL se fora dele. */
+static const uint8_t *img_span(Fat16Ctx *ctx, long off, size_t len) {
+  if (!ctx->map || off < 0)
+    return NULL;
+  if ((size_t)off + len > map_avail(ctx))
+    map_refresh(ctx);
+  if ((size_t)off + len > map_avail(ctx))
+    return NULL;
+  return ctx->map + off;
+}
 
-  ctx->fat_entries = ctx->fat_size_bytes / 2;
+/* ----- Instrumentação -----
+ * A E/S da imagem é contada em dev_read/dev_write (e por pedido no
+ * io_uring) com adições atômicas, pois leitores rodam em paralelo. Os
+ * laços quentes (cadeias da FAT, entradas de diretório) só incrementam
+ * contadores da thread, somados ao contexto no fim de cada operação
+ * pública (op_end) ou de cada thread do fsck. */
+static __thread uint64_t tl_fat_walked;
+static __thread uint64_t tl_dirents;
+
+static void stat_add(uint64_t *c, uint64_t n) {
+  if (n)
+    __atomic_fetch_add(c, n, __ATOMIC_RELAXED);
+}
+
+static void stats_flush_local(Fat16Ctx *ctx) {
+  stat_add(&ctx->stats.fat_walked, tl_fat_walked);
+  stat_add(&ctx->stats.dirents_scanned, tl_dirents);
+  tl_fat_walked = 0;
+  tl_dirents = 0;
+}
+
+static void io_count(Fat16Ctx *ctx, int wr, long off, size_t len) {
+  long prev = __atomic_exchange_n(&ctx->io_next, off + (long)len,
+                                  __ATOMIC_RELAXED);
+  if (prev != off)
+    stat_add(&ctx->stats.seeks, 1);
+  stat_add(wr ? &ctx->stats.writes : &ctx->stats.reads, 1);
+  stat_add(wr ? &ctx->stats.bytes_written : &ctx->stats.bytes_read, len);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t op_begin(void) { return now_ns(); }
+
+/* Fecha a medição de uma chamada pública iniciada em t0. */
+static void op_end(Fat16Ctx *ctx, int op, uint64_t t0) {
+  uint64_t ns = now_ns() - t0;
+  uint64_t us = ns / 1000;
+  int b = us ? 64 - __builtin_clzll(us) : 0;
+  if (b >= FAT16_LAT_BUCKETS)
+    b = FAT16_LAT_BUCKETS - 1;
+  Fat16OpStats *s = &ctx->stats.ops[op];
+  stat_add(&s->calls, 1);
+  stat_add(&s->total_ns, ns);
+  stat_add(&s->hist[b], 1);
+  uint64_t max = __atomic_load_n(&s->max_ns, __ATOMIC_RELAXED);
+  while (ns > max && !__atomic_compare_exchange_n(&s->max_ns, &max, ns, 1,
+                                                  __ATOMIC_RELAXED,
+                                                  __ATOMIC_RELAXED))
+    ;
+  stats_flush_local(ctx);
+}
+
+/* ----- Overlay copy-on-write (FAT16_OPEN_OVERLAY) -----
+ * A imagem base fica aberta só para leitura e toda escrita vai para um
+ * delta em blocos de OVL_BLOCK bytes: em memória ou num arquivo de
+ * registros {bloco, dados} acrescentados no fim (o delta só cresce com o
+ * que muda). Blocos fora do delta são lidos da base. A tabela hash mapeia o
+ * bloco para o buffer (memória) ou para o offset do registro (arquivo).
+ * fat16_overlay_commit aplica o delta na base; sem isso, o delta em memória
+ * some no fat16_close e o arquivo fica para uma próxima abertura.
+ */
+#define OVL_BLOCK 4096u
+#define OVL_MAGIC "F16DELTA"
+
+typedef struct {
+  char magic[8];
+  uint64_t size;      /* tamanho lógico da imagem com o delta */
+  uint64_t base_size; /* tamanho da base quando o delta começou */
+} OvlHeader;
+
+struct Fat16Overlay {
+  int fd;           /* arquivo delta; -1 → delta em memória */
+  char path[512];   /* imagem base (para o commit) */
+  uint32_t *keys;   /* bloco + 1 em cada posição (0 → vazia) */
+  uint8_t **data;   /* delta em memória: conteúdo do bloco */
+  long *rec;        /* delta em arquivo: offset do registro */
+  uint32_t cap;     /* potência de 2 */
+  uint32_t used;
+  long size;        /* tamanho lógico da imagem */
+  long base_size;
+  long end;         /* fim do arquivo delta (próximo registro) */
+};
+
+static uint32_t ovl_hash(const struct Fat16Overlay *o, uint32_t b) {
+  return (b * 2654435761u) & (o->cap - 1);
+}
+
+/* Posição do bloco b na tabela, ou -1 se ele não está no delta. */
+static long ovl_find(const struct Fat16Overlay *o, uint32_t b) {
+  for (uint32_t h = ovl_hash(o, b);; h = (h + 1) & (o->cap - 1)) {
+    if (o->keys[h] == 0)
+      return -1;
+    if (o->keys[h] == b + 1)
+      return (long)h;
+  }
+}
+
+static int ovl_grow(struct Fat16Overlay *o) {
+  uint32_t ncap = o->cap ? o->cap * 2 : 256;
+  struct Fat16Overlay n = *o;
+  n.cap = ncap;
+  n.keys = (uint32_t *)calloc(ncap, sizeof(uint32_t));
+  n.data = o->fd < 0 ? (uint8_t **)calloc(ncap, sizeof(uint8_t *)) : NULL;
+  n.rec = o->fd >= 0 ? (long *)calloc(ncap, sizeof(long)) : NULL;
+  if (!n.keys || (o->fd < 0 ? !n.data : !n.rec)) {
+    free(n.keys);
+    free(n.data);
+    free(n.rec);
+    return 0;
+  }
+  for (uint32_t i = 0; i < o->cap; i++) {
+    if (o->keys[i] == 0)
+      continue;
+    uint32_t h = ovl_hash(&n, o->keys[i] - 1);
+    while (n.keys[h] != 0)
+      h = (h + 1) & (ncap - 1);
+    n.keys[h] = o->keys[i];
+    if (o->fd < 0)
+      n.data[h] = o->data[i];
+    else
+      n.rec[h] = o->rec[i];
+  }
+  free(o->keys);
+  free(o->data);
+  free(o->rec);
+  *o = n;
   return 1;
 }
 
-static int save_fat(Fat16Ctx *ctx) {
-  long first =
-      (long)ctx->bpb.reserved_sectors * (long)ctx->bpb.bytes_per_sector;
-  for (int i = 0; i < ctx->bpb.num_fats; i++) {
-    long off = first + (long)i * (long)ctx->fat_size_bytes;
-    if (fseek(ctx->img, off, SEEK_SET) != 0)
+/* Lê [off, off+len) da base; o que passa do fim do arquivo base vira zero. */
+static int ovl_base_read(Fat16Ctx *ctx, long off, uint8_t *buf, size_t len) {
+  ssize_t r = 0;
+  if (off < ctx->overlay->base_size) {
+    r = pread(fileno(ctx->img), buf, len, (off_t)off);
+    if (r < 0)
       return 0;
-    if (fwrite(ctx->fat, ctx->fat_size_bytes, 1, ctx->img) != 1)
+  }
+  memset(buf + r, 0, len - (size_t)r);
+  return 1;
+}
+
+static int ovl_read(Fat16Ctx *ctx, long off, uint8_t *buf, size_t len) {
+  struct Fat16Overlay *o = ctx->overlay;
+  if (off < 0 || off + (long)len > o->size)
+    return 0; /* como o pread curto além do fim da imagem */
+  long run = -1; /* início de uma corrida pendente de blocos da base */
+  size_t done = 0;
+  while (done <= len) {
+    long at = off + (long)done;
+    long i = (done < len) ? ovl_find(o, (uint32_t)(at / OVL_BLOCK)) : -2;
+    if (i == -1) {
+      if (run < 0)
+        run = at;
+    } else {
+      if (run >= 0 && !ovl_base_read(ctx, run, buf + (run - off),
+                                     (size_t)(at - run)))
+        return 0;
+      run = -1;
+      if (i == -2)
+        break;
+    }
+    size_t in = (size_t)(at % OVL_BLOCK);
+    size_t n = OVL_BLOCK - in < len - done ? OVL_BLOCK - in : len - done;
+    if (i >= 0) {
+      if (o->fd < 0)
+        memcpy(buf + done, o->data[i] + in, n);
+      else if (pread(o->fd, buf + done, n,
+                     (off_t)(o->rec[i] + 8 + (long)in)) != (ssize_t)n)
+        return 0;
+    }
+    done += n;
+  }
+  return 1;
+}
+
+static int ovl_write(Fat16Ctx *ctx, long off, const uint8_t *buf,
+                     size_t len) {
+  struct Fat16Overlay *o = ctx->overlay;
+  uint8_t tmp[OVL_BLOCK];
+  size_t done = 0;
+  while (done < len) {
+    long at = off + (long)done;
+    uint32_t b = (uint32_t)(at / OVL_BLOCK);
+    size_t in = (size_t)(at % OVL_BLOCK);
+    size_t n = OVL_BLOCK - in < len - done ? OVL_BLOCK - in : len - done;
+    long i = ovl_find(o, b);
+    if (i < 0) {
+      /* primeira escrita no bloco: cópia do conteúdo atual (base) */
+      if ((o->used + 1) * 2 > o->cap && !ovl_grow(o))
+        return 0;
+      if (n < OVL_BLOCK &&
+          !ovl_base_read(ctx, (long)b * OVL_BLOCK, tmp, OVL_BLOCK))
+        return 0;
+      memcpy(tmp + in, buf + done, n);
+      uint32_t h = ovl_hash(o, b);
+      while (o->keys[h] != 0)
+        h = (h + 1) & (o->cap - 1);
+      if (o->fd < 0) {
+        uint8_t *p = (uint8_t *)malloc(OVL_BLOCK);
+        if (!p)
+          return 0;
+        memcpy(p, tmp, OVL_BLOCK);
+        o->data[h] = p;
+      } else {
+        uint64_t key = b;
+        if (pwrite(o->fd, &key, 8, (off_t)o->end) != 8 ||
+            pwrite(o->fd, tmp, OVL_BLOCK, (off_t)o->end + 8) != OVL_BLOCK)
+          return 0;
+        o->rec[h] = o->end;
+        o->end += 8 + (long)OVL_BLOCK;
+      }
+      o->keys[h] = b + 1;
+      o->used++;
+    } else if (o->fd < 0) {
+      memcpy(o->data[i] + in, buf + done, n);
+    } else if (pwrite(o->fd, buf + done, n,
+                      (off_t)(o->rec[i] + 8 + (long)in)) != (ssize_t)n) {
       return 0;
+    }
+    done += n;
   }
+  if (off + (long)len > o->size)
+    o->size = off + (long)len;
   return 1;
 }
 
-static int load_root(Fat16Ctx *ctx) {
-  uint32_t bytes_root = (uint32_t)ctx->bpb.root_entry_count * 32u;
-  ctx->root_dir_sectors =
-      (bytes_root + ctx->bpb.bytes_per_sector - 1) / ctx->bpb.bytes_per_sector;
+/* Delta em arquivo: regrava o cabeçalho (tamanho lógico atual). */
+static int ovl_sync(Fat16Ctx *ctx) {
+  struct Fat16Overlay *o = ctx->overlay;
+  if (o->fd < 0)
+    return 1;
+  OvlHeader hd;
+  memcpy(hd.magic, OVL_MAGIC, 8);
+  hd.size = (uint64_t)o->size;
+  hd.base_size = (uint64_t)o->base_size;
+  return pwrite(o->fd, &hd, sizeof(hd), 0) == (ssize_t)sizeof(hd);
+}
 
-  long root_off = (long)(ctx->bpb.reserved_sectors +
-                         (ctx->bpb.num_fats * ctx->bpb.fat_size_16)) *
-                  (long)ctx->bpb.bytes_per_sector;
+/* Esvazia o delta (depois do commit). */
+static void ovl_clear(struct Fat16Overlay *o) {
+  for (uint32_t i = 0; o->data && i < o->cap; i++)
+    free(o->data[i]);
+  if (o->cap) {
+    memset(o->keys, 0, sizeof(uint32_t) * o->cap);
+    if (o->data)
+      memset(o->data, 0, sizeof(uint8_t *) * o->cap);
+  }
+  o->used = 0;
+  o->end = (long)sizeof(OvlHeader);
+}
 
-  ctx->root = (DirectoryEntry *)malloc(ctx->bpb.root_entry_count *
-                                       sizeof(DirectoryEntry));
-  if (!ctx->root)
+/*
+ * Abre o delta sobre a base já aberta em ctx->img. delta == NULL → em
+ * memória; senão o arquivo é criado, ou reaberto e seus registros
+ * recarregados (deve ter sido criado sobre esta mesma base).
+ */
+static int ovl_open(Fat16Ctx *ctx, const char *img_path, const char *delta) {
+  struct stat st;
+  if (fstat(fileno(ctx->img), &st) != 0)
+    return 0;
+  struct Fat16Overlay *o = (struct Fat16Overlay *)calloc(1, sizeof(*o));
+  if (!o)
     return 0;
+  ctx->overlay = o;
+  snprintf(o->path, sizeof(o->path), "%s", img_path);
+  o->fd = -1;
+  o->size = o->base_size = (long)st.st_size;
+  o->end = (long)sizeof(OvlHeader);
+  if (!delta)
+    return ovl_grow(o);
 
-  if (fseek(ctx->img, root_off, SEEK_SET) != 0)
+  o->fd = open(delta, O_RDWR | O_CREAT, 0644);
+  if (o->fd < 0 || !ovl_grow(o))
     return 0;
-  if (fread(ctx->root, sizeof(DirectoryEntry), ctx->bpb.root_entry_count,
-            ctx->img) != ctx->bpb.root_entry_count)
+  OvlHeader hd;
+  ssize_t r = pread(o->fd, &hd, sizeof(hd), 0);
+  if (r == 0)
+    return ovl_sync(ctx); /* delta novo */
+  if (r != (ssize_t)sizeof(hd) || memcmp(hd.magic, OVL_MAGIC, 8) != 0 ||
+      hd.base_size != (uint64_t)o->base_size) {
+    printf("Delta '%s' inválido ou de outra imagem.\n", delta);
     return 0;
-
-  ctx->first_data_sector = ctx->bpb.reserved_sectors +
-                           (ctx->bpb.num_fats * ctx->bpb.fat_size_16) +
-                           ctx->root_dir_sectors;
+  }
+  o->size = (long)hd.size;
+  /* registros inteiros apenas: um rasgado no fim é sobrescrito */
+  struct stat dst;
+  if (fstat(o->fd, &dst) != 0)
+    return 0;
+  uint64_t key;
+  while (o->end + 8 + (long)OVL_BLOCK <= (long)dst.st_size &&
+         pread(o->fd, &key, 8, (off_t)o->end) == 8) {
+    if ((o->used + 1) * 2 > o->cap && !ovl_grow(o))
+      return 0;
+    uint32_t h = ovl_hash(o, (uint32_t)key);
+    while (o->keys[h] != 0)
+      h = (h + 1) & (o->cap - 1);
+    o->keys[h] = (uint32_t)key + 1;
+    o->rec[h] = o->end;
+    o->used++;
+    o->end += 8 + (long)OVL_BLOCK;
+  }
   return 1;
 }
 
-static int save_root(Fat16Ctx *ctx) {
-  long root_off = (long)(ctx->bpb.reserved_sectors +
-                         (ctx->bpb.num_fats * ctx->bpb.fat_size_16)) *
-                  (long)ctx->bpb.bytes_per_sector;
-  if (fseek(ctx->img, root_off, SEEK_SET) != 0)
-    return 0;
-  if (fwrite(ctx->root, sizeof(DirectoryEntry), ctx->bpb.root_entry_count,
-             ctx->img) != ctx->bpb.root_entry_count)
-    return 0;
-  return 1;
+static void ovl_free(Fat16Ctx *ctx) {
+  struct Fat16Overlay *o = ctx->overlay;
+  if (!o)
+    return;
+  if (o->fd >= 0) {
+    ovl_sync(ctx);
+    fdatasync(o->fd);
+    close(o->fd);
+  }
+  for (uint32_t i = 0; o->data && i < o->cap; i++)
+    free(o->data[i]);
+  free(o->keys);
+  free(o->data);
+  free(o->rec);
+  free(o);
+  ctx->overlay = NULL;
 }
 
-static void compute_derived(Fat16Ctx *ctx) {
-  ctx->total_sectors = (ctx->bpb.total_sectors_16 != 0)
-                           ? ctx->bpb.total_sectors_16
-                           : ctx->bpb.total_sectors_32;
-  ctx->cluster_size = (uint32_t)ctx->bpb.sectors_per_cluster *
-                      (uint32_t)ctx->bpb.bytes_per_sector;
+static int dev_read(Fat16Ctx *ctx, long off, void *buf, size_t len) {
+  io_count(ctx, 0, off, len);
+  if (ctx->overlay)
+    return ovl_read(ctx, off, (uint8_t *)buf, len);
+  if (ctx->map) {
+    const uint8_t *p = img_span(ctx, off, len);
+    if (!p)
+      return 0;
+    memcpy(buf, p, len);
+    return 1;
+  }
+  /* pread não usa a posição compartilhada do FILE*: leitores concorrentes
+   * não interferem entre si */
+  return pread(fileno(ctx->img), buf, len, (off_t)off) == (ssize_t)len;
+}
 
-  uint32_t non_data =
-      (uint32_t)ctx->bpb.reserved_sectors +
-      (uint32_t)ctx->bpb.num_fats * (uint32_t)ctx->bpb.fat_size_16 +
-      (uint32_t)ctx->root_dir_sectors;
-  ctx->data_sectors =
-      (ctx->total_sectors > non_data) ? (ctx->total_sectors - non_data) : 0;
-  ctx->cluster_count = (ctx->bpb.sectors_per_cluster != 0)
-                           ? (ctx->data_sectors / ctx->bpb.sectors_per_cluster)
-                           : 0;
+/* Como dev_read, mas aceita o fim do arquivo: retorna quantos bytes
+ * existiam (< len se [off, off+len) passa do fim) ou -1 em erro. Só é
+ * usada pelo cache de blocos, que não convive com o mapa. */
+static long dev_read_avail(Fat16Ctx *ctx, long off, uint8_t *buf,
+                           size_t len) {
+  if (ctx->overlay) /* ovl_read já completa com zeros */
+    return dev_read(ctx, off, buf, len) ? (long)len : -1;
+  io_count(ctx, 0, off, len);
+  size_t got = 0;
+  while (got < len) {
+    ssize_t r = pread(fileno(ctx->img), buf + got, len - got,
+                      (off_t)(off + (long)got));
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0)
+      return -1;
+    if (r == 0)
+      break;
+    got += (size_t)r;
+  }
+  return (long)got;
 }
 
-static void decode_date(uint16_t d, int *day, int *mon, int *year) {
-  *day = d & 0x1F;
-  *mon = (d >> 5) & 0x0F;
-  *year = ((d >> 9) & 0x7F) + 1980;
+static int dev_write(Fat16Ctx *ctx, long off, const void *buf, size_t len) {
+  io_count(ctx, 1, off, len);
+  if (ctx->overlay)
+    return ovl_write(ctx, off, (const uint8_t *)buf, len);
+  if (ctx->map) {
+    if ((size_t)off + len <= map_avail(ctx)) {
+      memcpy(ctx->map + off, buf, len);
+      return 1;
+    }
+    /* além do fim do arquivo: pwrite estende o arquivo; o mapa (MAP_SHARED)
+     * já reserva o endereço e passa a enxergar os bytes novos */
+    if (pwrite(fileno(ctx->img), buf, len, (off_t)off) != (ssize_t)len)
+      return 0;
+    map_refresh(ctx);
+    return 1;
+  }
+  return pwrite(fileno(ctx->img), buf, len, (off_t)off) == (ssize_t)len;
 }
-static void decode_time(uint16_t t, int *hh, int *mm, int *ss) {
-  *ss = (t & 0x1F) * 2;
-  *mm = (t >> 5) & 0x3F;
-  *hh = (t >> 11) & 0x1F;
+
+/* ----- Cache de blocos (setores) com write-back -----
+ * Fica entre a lógica do FS e dev_read/dev_write quando aberto com
+ * cache_blocks > 0 (só no backend stdio; com mmap o page cache já cumpre
+ * esse papel). Blocos têm o tamanho do setor; o índice é uma tabela hash
+ * encadeada e a substituição é LRU (lista duplamente ligada) ou CLOCK.
+ * Blocos sujos vão para a imagem ao serem despejados e em
+ * fat16_flush/fat16_close, nesse caso dados antes de metadados.
+ */
+#define BC_NONE UINT32_MAX
+#define BC_READ_RUN 128 /* blocos por leitura agrupada em falta de cache */
+
+struct Fat16BlockCache {
+  uint32_t bsize;
+  uint32_t nblocks;
+  int policy;
+  uint8_t *data;     /* nblocks * bsize */
+  uint32_t *blockno; /* bloco da imagem em cada posição (BC_NONE → vazia) */
+  uint8_t *dirty;
+  uint8_t *ref; /* CLOCK */
+  uint32_t hand;
+  int32_t *prev, *next; /* LRU: cabeça = mais recente */
+  int32_t lru_head, lru_tail;
+  int32_t *head, *hnext; /* hash blockno → posição */
+  uint32_t hmask;
+  uint8_t *bounce; /* BC_READ_RUN blocos */
+};
+
+static uint32_t bc_hash(const struct Fat16BlockCache *bc, uint32_t b) {
+  return (b * 2654435761u) & bc->hmask;
 }
 
-static uint16_t encode_date(int day, int mon, int year) {
-  return (uint16_t)(((year - 1980) << 9) | (mon << 5) | day);
+static int32_t bc_lookup(struct Fat16BlockCache *bc, uint32_t b) {
+  int32_t i = bc->head[bc_hash(bc, b)];
+  while (i >= 0 && bc->blockno[i] != b)
+    i = bc->hnext[i];
+  return i;
 }
-static uint16_t encode_time(int hh, int mm, int ss) {
-  return (uint16_t)((hh << 11) | (mm << 5) | (ss / 2));
+
+static void bc_unhash(struct Fat16BlockCache *bc, int32_t i) {
+  int32_t *pp = &bc->head[bc_hash(bc, bc->blockno[i])];
+  while (*pp >= 0 && *pp != i)
+    pp = &bc->hnext[*pp];
+  if (*pp == i)
+    *pp = bc->hnext[i];
 }
-static void now_fat(uint16_t *d, uint16_t *t) {
-  time_t now = time(NULL);
-  struct tm *tmv = localtime(&now);
-  *d = encode_date(tmv->tm_mday, tmv->tm_mon + 1, tmv->tm_year + 1900);
-  *t = encode_time(tmv->tm_hour, tmv->tm_min, tmv->tm_sec);
+
+static void lru_unlink(struct Fat16BlockCache *bc, int32_t i) {
+  if (bc->prev[i] >= 0)
+    bc->next[bc->prev[i]] = bc->next[i];
+  else
+    bc->lru_head = bc->next[i];
+  if (bc->next[i] >= 0)
+    bc->prev[bc->next[i]] = bc->prev[i];
+  else
+    bc->lru_tail = bc->prev[i];
 }
 
-void fat16_to83(const char *in, char name[8], char ext[3]) {
-  memset(name, ' ', 8);
-  memset(ext, ' ', 3);
-  const char *dot = strrchr(in, '.');
-  if (dot) {
-    int nlen = (int)(dot - in);
-    if (nlen > 8)
-      nlen = 8;
-    for (int i = 0; i < nlen; i++)
-      name[i] = (char)toupper((unsigned char)in[i]);
-    int elen = (int)strlen(dot + 1);
-    if (elen > 3)
-      elen = 3;
-    for (int i = 0; i < elen; i++)
-      ext[i] = (char)toupper((unsigned char)dot[1 + i]);
-  } else {
-    int nlen = (int)strlen(in);
-    if (nlen > 8)
-      nlen = 8;
-    for (int i = 0; i < nlen; i++)
-      name[i] = (char)toupper((unsigned char)in[i]);
-  }
+static void lru_push_front(struct Fat16BlockCache *bc, int32_t i) {
+  bc->prev[i] = -1;
+  bc->next[i] = bc->lru_head;
+  if (bc->lru_head >= 0)
+    bc->prev[bc->lru_head] = i;
+  bc->lru_head = i;
+  if (bc->lru_tail < 0)
+    bc->lru_tail = i;
 }
 
-static void make_readable(const DirectoryEntry *e, char out[13]) {
-  int p = 0;
-  for (int i = 0; i < 8 && e->filename[i] != ' '; i++)
-    out[p++] = e->filename[i];
-  if (e->extension[0] != ' ') {
-    out[p++] = '.';
-    for (int i = 0; i < 3 && e->extension[i] != ' '; i++)
-      out[p++] = e->extension[i];
+static void bc_touch(struct Fat16BlockCache *bc, int32_t i) {
+  if (bc->policy == FAT16_CACHE_CLOCK) {
+    bc->ref[i] = 1;
+  } else if (bc->lru_head != i) {
+    lru_unlink(bc, i);
+    lru_push_front(bc, i);
   }
-  out[p] = '\0';
 }
 
-static int entry_free(const DirectoryEntry *e) {
-  return (e->filename[0] == 0x00) || ((unsigned char)e->filename[0] == 0xE5);
-}
-static int entry_regular(const DirectoryEntry *e) {
-  if (entry_free(e))
-    return 0;
-  if (e->attributes & ATTR_VOLUME_ID)
-    return 0;
-  if (e->attributes & ATTR_DIRECTORY)
+static int bc_writeback(Fat16Ctx *ctx, int32_t i) {
+  struct Fat16BlockCache *bc = ctx->bcache;
+  if (!bc->dirty[i])
+    return 1;
+  if (!dev_write(ctx, (long)bc->blockno[i] * (long)bc->bsize,
+                 bc->data + (size_t)i * bc->bsize, bc->bsize))
     return 0;
+  bc->dirty[i] = 0;
+  ctx->cache_writebacks++;
   return 1;
 }
 
-static long cluster_offset(Fat16Ctx *ctx, uint16_t cluster) {
-  uint32_t sector =
-      ((uint32_t)(cluster - 2) * (uint32_t)ctx->bpb.sectors_per_cluster) +
-      ctx->first_data_sector;
-  return (long)sector * (long)ctx->bpb.bytes_per_sector;
+/* Escolhe uma posição para o bloco b (gravando a vítima se estiver suja) e
+ * a insere no índice. O conteúdo fica a cargo de quem chamou. */
+static int32_t bc_install(Fat16Ctx *ctx, uint32_t b) {
+  struct Fat16BlockCache *bc = ctx->bcache;
+  int32_t v;
+  if (bc->policy == FAT16_CACHE_CLOCK) {
+    for (;;) {
+      v = (int32_t)bc->hand;
+      bc->hand = (bc->hand + 1) % bc->nblocks;
+      if (bc->blockno[v] == BC_NONE || !bc->ref[v])
+        break;
+      bc->ref[v] = 0;
+    }
+  } else {
+    v = bc->lru_tail;
+  }
+  if (bc->blockno[v] != BC_NONE) {
+    if (!bc_writeback(ctx, v))
+      return -1;
+    bc_unhash(bc, v);
+  }
+  bc->blockno[v] = b;
+  uint32_t h = bc_hash(bc, b);
+  bc->hnext[v] = bc->head[h];
+  bc->head[h] = v;
+  bc_touch(bc, v);
+  return v;
 }
 
-static DirectoryEntry *find_by_name(Fat16Ctx *ctx, const char *name83) {
-  char n[8], x[3];
-  fat16_to83(name83, n, x);
-  for (int i = 0; i < ctx->bpb.root_entry_count; i++) {
-    DirectoryEntry *e = &ctx->root[i];
-    if (!entry_regular(e))
-      continue;
-    if (memcmp(e->filename, n, 8) == 0 && memcmp(e->extension, x, 3) == 0)
-      return e;
-  }
-  return NULL;
+/* Copia para buf a parte de [off, off+len) que cai no bloco b. */
+static void bc_copy_out(uint32_t bs, uint32_t b, const uint8_t *blk, long off,
+                        size_t len, uint8_t *buf) {
+  long bstart = (long)b * bs;
+  long from = (off > bstart) ? off : bstart;
+  long to = (off + (long)len < bstart + (long)bs) ? off + (long)len
+                                                  : bstart + (long)bs;
+  memcpy(buf + (from - off), blk + (from - bstart), (size_t)(to - from));
 }
 
-static DirectoryEntry *find_free_dir(Fat16Ctx *ctx) {
-  for (int i = 0; i < ctx->bpb.root_entry_count; i++) {
-    if (entry_free(&ctx->root[i]))
-      return &ctx->root[i];
+static int bc_read(Fat16Ctx *ctx, long off, uint8_t *buf, size_t len) {
+  struct Fat16BlockCache *bc = ctx->bcache;
+  uint32_t bs = bc->bsize;
+  uint32_t b = (uint32_t)(off / bs), last = (uint32_t)((off + len - 1) / bs);
+  while (b <= last) {
+    int32_t i = bc_lookup(bc, b);
+    if (i >= 0) {
+      ctx->cache_hits++;
+      bc_touch(bc, i);
+      bc_copy_out(bs, b, bc->data + (size_t)i * bs, off, len, buf);
+      b++;
+      continue;
+    }
+    /* agrupa as faltas consecutivas numa leitura só */
+    uint32_t e = b + 1;
+    while (e <= last && e - b < BC_READ_RUN && bc_lookup(bc, e) < 0)
+      e++;
+    if (!dev_read(ctx, (long)b * bs, bc->bounce, (size_t)(e - b) * bs))
+      return 0;
+    for (uint32_t k = b; k < e; k++) {
+      const uint8_t *src = bc->bounce + (size_t)(k - b) * bs;
+      ctx->cache_misses++;
+      int32_t j = bc_install(ctx, k);
+      if (j < 0)
+        return 0;
+      memcpy(bc->data + (size_t)j * bs, src, bs);
+      bc_copy_out(bs, k, src, off, len, buf);
+    }
+    b = e;
   }
-  return NULL;
+  return 1;
 }
 
-static uint16_t find_free_cluster_from(Fat16Ctx *ctx, uint16_t start) {
-  if (start < 2)
-    start = 2;
-  for (uint32_t i = start; i < ctx->fat_entries; i++) {
-    if (ctx->fat[i] == FAT16_FREE)
-      return (uint16_t)i;
+/* Tira a posição i do índice sem gravá-la; ela é a próxima a ser reusada. */
+static void bc_drop(struct Fat16BlockCache *bc, int32_t i) {
+  bc_unhash(bc, i);
+  bc->blockno[i] = BC_NONE;
+  bc->dirty[i] = 0;
+  bc->ref[i] = 0;
+  if (bc->policy == FAT16_CACHE_LRU && bc->lru_tail != i) {
+    lru_unlink(bc, i);
+    bc->prev[i] = bc->lru_tail;
+    bc->next[i] = -1;
+    bc->next[bc->lru_tail] = i;
+    bc->lru_tail = i;
   }
-  return 0;
 }
 
-static uint16_t allocate_chain(Fat16Ctx *ctx, int n, uint16_t *out_chain) {
-  uint16_t cursor = 2;
-  for (int i = 0; i < n; i++) {
-    uint16_t c = find_free_cluster_from(ctx, cursor);
-    if (c == 0) {
-      for (int k = 0; k < i; k++)
-        ctx->fat[out_chain[k]] = FAT16_FREE;
-      return 0;
+static int bc_write(Fat16Ctx *ctx, long off, const uint8_t *buf, size_t len) {
+  struct Fat16BlockCache *bc = ctx->bcache;
+  uint32_t bs = bc->bsize;
+  uint32_t b = (uint32_t)(off / bs), last = (uint32_t)((off + len - 1) / bs);
+  for (; b <= last; b++) {
+    long bstart = (long)b * bs;
+    long from = (off > bstart) ? off : bstart;
+    long to =
+        ((long)(off + len) < bstart + bs) ? (long)(off + len) : bstart + bs;
+    int32_t i = bc_lookup(bc, b);
+    if (i >= 0) {
+      ctx->cache_hits++;
+      bc_touch(bc, i);
+    } else {
+      ctx->cache_misses++;
+      i = bc_install(ctx, b);
+      if (i < 0)
+        return 0;
+      /* escrita parcial precisa do resto do bloco; além do fim do arquivo
+       * o conteúdo é zero, como numa escrita stdio que estende a imagem */
+      if (to - from < (long)bs) {
+        uint8_t *blk = bc->data + (size_t)i * bs;
+        long got = dev_read_avail(ctx, bstart, blk, bs);
+        if (got < 0) {
+          bc_drop(bc, i); /* sem o resto do bloco não há o que gravar */
+          return 0;
+        }
+        memset(blk + got, 0, bs - (size_t)got);
+      }
     }
-    ctx->fat[c] = FAT16_EOF; /* reserva */
-    out_chain[i] = c;
-    cursor = c + 1;
+    memcpy(bc->data + (size_t)i * bs + (from - bstart), buf + (from - off),
+           (size_t)(to - from));
+    bc->dirty[i] = 1;
   }
-  for (int i = 0; i < n - 1; i++)
-    ctx->fat[out_chain[i]] = out_chain[i + 1];
-  ctx->fat[n - 1] = FAT16_EOF;
-  return out_chain[0];
+  return 1;
 }
 
-static uint8_t *read_chain(Fat16Ctx *ctx, const DirectoryEntry *e,
-                           uint32_t *sz) {
-  *sz = e->file_size;
-  if (*sz == 0)
-    return NULL;
-  uint8_t *buf = (uint8_t *)malloc(*sz);
-  if (!buf) {
-    printf("Erro de memória.\n");
-    return NULL;
-  }
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
 
-  uint32_t got = 0, steps = 0;
-  uint16_t c = e->first_cluster_low;
-  while (got < *sz) {
-    if (c < 2 || c >= ctx->fat_entries) {
-      printf("Cluster fora do limite.\n");
-      free(buf);
-      return NULL;
-    }
-    if (c == FAT16_FREE) {
-      printf("Cadeia interrompida.\n");
-      free(buf);
-      return NULL;
-    }
-    if (c == FAT16_BAD) {
-      printf("Cluster BAD.\n");
-      free(buf);
-      return NULL;
-    }
+/* Esquece os blocos de [off, off+len) sem gravá-los (a região virou
+ * buraco na imagem). As posições liberadas são as próximas a reusar. */
+static void bc_discard(Fat16Ctx *ctx, long off, size_t len) {
+  struct Fat16BlockCache *bc = ctx->bcache;
+  uint32_t b = (uint32_t)(off / bc->bsize);
+  uint32_t last = (uint32_t)((off + (long)len - 1) / bc->bsize);
+  for (; b <= last; b++) {
+    int32_t i = bc_lookup(bc, b);
+    if (i >= 0)
+      bc_drop(bc, i);
+  }
+}
 
-    long off = cluster_offset(ctx, c);
-    if (fseek(ctx->img, off, SEEK_SET) != 0) {
-      free(buf);
-      return NULL;
-    }
+/* Grava todos os blocos sujos: primeiro os da área de dados, depois FAT e
+ * raiz, cada grupo em ordem crescente e juntando blocos vizinhos. */
+static int bc_flush(Fat16Ctx *ctx) {
+  struct Fat16BlockCache *bc = ctx->bcache;
+  if (!bc)
+    return 1;
+  uint32_t bs = bc->bsize;
+  uint32_t *list = (uint32_t *)malloc(sizeof(uint32_t) * bc->nblocks);
+  if (!list)
+    return 0;
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < bc->nblocks; i++)
+    if (bc->blockno[i] != BC_NONE && bc->dirty[i])
+      list[n++] = bc->blockno[i];
+  qsort(list, n, sizeof(uint32_t), cmp_u32);
 
-    uint32_t to_read = *sz - got;
-    if (to_read > ctx->cluster_size)
-      to_read = ctx->cluster_size;
-    if (fread(buf + got, 1, to_read, ctx->img) != to_read) {
-      printf("Falha leitura.\n");
-      free(buf);
-      return NULL;
-    }
-    got += to_read;
+  uint32_t data_block = (uint32_t)(((uint64_t)ctx->first_data_sector *
+                                    ctx->bpb.bytes_per_sector) / bs);
+  uint32_t split = 0;
+  while (split < n && list[split] < data_block)
+    split++;
 
-    if (c >= FAT16_EOF_MIN)
-      break;
-    uint16_t next = ctx->fat[c];
-    if (++steps > ctx->cluster_count + 8) {
-      printf("Loop suspeito.\n");
-      free(buf);
-      return NULL;
+  int ok = 1;
+  for (int pass = 0; pass < 2; pass++) {
+    uint32_t from = pass == 0 ? split : 0, to = pass == 0 ? n : split;
+    uint32_t k = from;
+    while (k < to) {
+      uint32_t run = 1;
+      while (k + run < to && run < BC_READ_RUN &&
+             list[k + run] == list[k] + run)
+        run++;
+      for (uint32_t r = 0; r < run; r++)
+        memcpy(bc->bounce + (size_t)r * bs,
+               bc->data + (size_t)bc_lookup(bc, list[k + r]) * bs, bs);
+      if (dev_write(ctx, (long)list[k] * bs, bc->bounce, (size_t)run * bs)) {
+        for (uint32_t r = 0; r < run; r++)
+          bc->dirty[bc_lookup(bc, list[k + r])] = 0;
+        ctx->cache_writebacks += run;
+      } else {
+        ok = 0;
+      }
+      k += run;
     }
-    c = next;
   }
-  return buf;
+  free(list);
+  return ok;
 }
 
-/* ================= Implementação da API pública ================= */
+static void bc_free(Fat16Ctx *ctx) {
+  struct Fat16BlockCache *bc = ctx->bcache;
+  if (!bc)
+    return;
+  free(bc->data);
+  free(bc->blockno);
+  free(bc->dirty);
+  free(bc->ref);
+  free(bc->prev);
+  free(bc->next);
+  free(bc->head);
+  free(bc->hnext);
+  free(bc->bounce);
+  free(bc);
+  ctx->bcache = NULL;
+}
 
-int fat16_open(Fat16Ctx *ctx, const char *img_path) {
-  memset(ctx, 0, sizeof(*ctx));
-  ctx->img = fopen(img_path, "r+b");
-  if (!ctx->img) {
-    printf("Não consegui abrir '%s'.\n", img_path);
+static int bc_init(Fat16Ctx *ctx, uint32_t nblocks, int policy) {
+  struct Fat16BlockCache *bc =
+      (struct Fat16BlockCache *)calloc(1, sizeof(struct Fat16BlockCache));
+  if (!bc)
     return 0;
-  }
-  if (!load_boot(ctx)) {
-    printf("Boot inválido.\n");
-    fat16_close(ctx);
+  ctx->bcache = bc;
+  bc->bsize = ctx->bpb.bytes_per_sector;
+  bc->nblocks = nblocks;
+  bc->policy = policy;
+  uint32_t buckets = 16;
+  while (buckets < nblocks)
+    buckets <<= 1;
+  bc->hmask = buckets - 1;
+
+  bc->data = (uint8_t *)malloc((size_t)nblocks * bc->bsize);
+  bc->blockno = (uint32_t *)malloc(sizeof(uint32_t) * nblocks);
+  bc->dirty = (uint8_t *)calloc(nblocks, 1);
+  bc->ref = (uint8_t *)calloc(nblocks, 1);
+  bc->prev = (int32_t *)malloc(sizeof(int32_t) * nblocks);
+  bc->next = (int32_t *)malloc(sizeof(int32_t) * nblocks);
+  bc->head = (int32_t *)malloc(sizeof(int32_t) * buckets);
+  bc->hnext = (int32_t *)malloc(sizeof(int32_t) * nblocks);
+  bc->bounce = (uint8_t *)malloc((size_t)BC_READ_RUN * bc->bsize);
+  if (!bc->data || !bc->blockno || !bc->dirty || !bc->ref || !bc->prev ||
+      !bc->next || !bc->head || !bc->hnext || !bc->bounce) {
+    bc_free(ctx);
     return 0;
   }
-  if (!load_fat(ctx)) {
-    printf("FAT inválida.\n");
-    fat16_close(ctx);
-    return 0;
+  for (uint32_t i = 0; i < buckets; i++)
+    bc->head[i] = -1;
+  bc->lru_head = bc->lru_tail = -1;
+  for (uint32_t i = 0; i < nblocks; i++) {
+    bc->blockno[i] = BC_NONE;
+    bc->hnext[i] = -1;
+    lru_push_front(bc, (int32_t)i);
   }
-  if (!load_root(ctx)) {
-    printf("Root inválido.\n");
-    fat16_close(ctx);
+  return 1;
+}
+
+/* O cache é compartilhado entre leitores: cache_lock protege o cache e os
+ * contadores. Sem cache, a E/S posicional dispensa trava. */
+static int img_read(Fat16Ctx *ctx, long off, void *buf, size_t len) {
+  if (len == 0)
+    return 1;
+  if (!ctx->bcache)
+    return dev_read(ctx, off, buf, len);
+  pthread_mutex_lock(&ctx->cache_lock);
+  int ok = bc_read(ctx, off, (uint8_t *)buf, len);
+  pthread_mutex_unlock(&ctx->cache_lock);
+  return ok;
+}
+
+static int img_write(Fat16Ctx *ctx, long off, const void *buf, size_t len) {
+  if (len == 0)
+    return 1;
+  if (!ctx->bcache)
+    return dev_write(ctx, off, buf, len);
+  pthread_mutex_lock(&ctx->cache_lock);
+  int ok = bc_write(ctx, off, (const uint8_t *)buf, len);
+  pthread_mutex_unlock(&ctx->cache_lock);
+  return ok;
+}
+
+/* Modo esparso: devolve [off, off+len) ao sistema de arquivos do host; a
+ * região passa a ler como zeros. Retorna 0 se o host não suporta. */
+static int img_punch(Fat16Ctx *ctx, long off, size_t len) {
+  if (len == 0)
+    return 1;
+  if (ctx->bcache) {
+    pthread_mutex_lock(&ctx->cache_lock);
+    bc_discard(ctx, off, len);
+    pthread_mutex_unlock(&ctx->cache_lock);
+  }
+  return fallocate(fileno(ctx->img), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                   (off_t)off, (off_t)len) == 0;
+}
+
+/* ----- E/S em lote: io_uring quando disponível, senão uma chamada por
+ * pedido -----
+ * Um lote é uma lista de pedidos (offset, buffer, tamanho) sobre clusters.
+ * Com o anel ativo (FAT16_OPEN_URING, backend stdio sem cache de blocos)
+ * até uring_depth pedidos vão numa só submissão e as conclusões são
+ * colhidas juntas; o anel é montado com as syscalls diretas, sem liburing. */
+
+typedef struct {
+  long off;
+  uint8_t *buf;
+  size_t len;
+} IoReq;
+
+#define IO_BATCH 64 /* pedidos acumulados por lote nos leitores */
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define FAT16_HAVE_URING 1
+#endif
+#endif
+
+#ifdef FAT16_HAVE_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+struct Fat16Uring {
+  int fd;
+  unsigned depth;
+  uint8_t *sq_ring, *cq_ring;
+  size_t sq_len, cq_len;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+static void uring_free(Fat16Ctx *ctx) {
+  struct Fat16Uring *u = ctx->uring;
+  if (!u)
+    return;
+  if (u->sqes)
+    munmap(u->sqes, u->sqes_len);
+  if (u->cq_ring && u->cq_ring != u->sq_ring)
+    munmap(u->cq_ring, u->cq_len);
+  if (u->sq_ring)
+    munmap(u->sq_ring, u->sq_len);
+  if (u->fd >= 0)
+    close(u->fd);
+  free(u);
+  __atomic_store_n(&ctx->uring, NULL, __ATOMIC_RELEASE);
+}
+
+/* O kernel tem IORING_OP_READ/WRITE? (o anel existe desde o 5.1, essas
+ * operações só desde o 5.6; sem elas toda conclusão viria com -EINVAL) */
+static int uring_probe(int fd) {
+  size_t len = sizeof(struct io_uring_probe) +
+               256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *pr = (struct io_uring_probe *)calloc(1, len);
+  if (!pr)
+    return 0;
+  int ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, pr,
+                   256) == 0 &&
+           pr->last_op >= IORING_OP_READ && pr->last_op >= IORING_OP_WRITE &&
+           (pr->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+           (pr->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+  free(pr);
+  return ok;
+}
+
+static int uring_init(Fat16Ctx *ctx, unsigned depth) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+  if (fd < 0)
+    return 0;
+  if (!uring_probe(fd)) {
+    close(fd);
+    return 0;
+  }
+  struct Fat16Uring *u = (struct Fat16Uring *)calloc(1, sizeof(*u));
+  if (!u) {
+    close(fd);
+    return 0;
+  }
+  ctx->uring = u;
+  u->fd = fd;
+  u->depth = p.sq_entries;
+
+  u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (u->cq_len > u->sq_len)
+      u->sq_len = u->cq_len;
+    u->cq_len = u->sq_len;
+  }
+  void *sq = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) {
+    uring_free(ctx);
+    return 0;
+  }
+  u->sq_ring = (uint8_t *)sq;
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    u->cq_ring = u->sq_ring;
+  } else {
+    void *cq = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) {
+      uring_free(ctx);
+      return 0;
+    }
+    u->cq_ring = (uint8_t *)cq;
+  }
+  u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    uring_free(ctx);
+    return 0;
+  }
+  u->sqes = (struct io_uring_sqe *)sqes;
+
+  u->sq_head = (unsigned *)(u->sq_ring + p.sq_off.head);
+  u->sq_tail = (unsigned *)(u->sq_ring + p.sq_off.tail);
+  u->sq_mask = (unsigned *)(u->sq_ring + p.sq_off.ring_mask);
+  u->sq_array = (unsigned *)(u->sq_ring + p.sq_off.array);
+  u->cq_head = (unsigned *)(u->cq_ring + p.cq_off.head);
+  u->cq_tail = (unsigned *)(u->cq_ring + p.cq_off.tail);
+  u->cq_mask = (unsigned *)(u->cq_ring + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(u->cq_ring + p.cq_off.cqes);
+  return 1;
+}
+
+/* Espera e descarta as conclusões de k pedidos já submetidos. */
+static int uring_drain(struct Fat16Uring *u, unsigned k) {
+  while (k > 0) {
+    long r = syscall(__NR_io_uring_enter, u->fd, 0, k, IORING_ENTER_GETEVENTS,
+                     NULL, 0);
+    if (r < 0 && errno != EINTR)
+      return 0;
+    unsigned head = *u->cq_head;
+    unsigned ctail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != ctail && k > 0; head++)
+      k--;
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+  }
+  return 1;
+}
+
+/* Submete até depth pedidos de uma vez e espera todas as conclusões.
+ * Transferências curtas e pedidos que o anel recusou são completados de
+ * forma síncrona. Retorna 1 se tudo completou, 0 em erro de E/S e -1 se o
+ * próprio io_uring_enter falhou: aí nada do lote fica pendurado no anel,
+ * que é desmontado (ctx->uring = NULL) para o chamador refazer o lote. */
+static int uring_round(Fat16Ctx *ctx, int wr, IoReq *q, unsigned n) {
+  struct Fat16Uring *u = ctx->uring;
+  int fd = fileno(ctx->img);
+  unsigned tail = *u->sq_tail;
+  for (unsigned i = 0; i < n; i++) {
+    unsigned idx = (tail + i) & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = wr ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)q[i].buf;
+    sqe->len = (uint32_t)q[i].len;
+    sqe->off = (uint64_t)q[i].off;
+    sqe->user_data = i;
+    u->sq_array[idx] = idx;
+    io_count(ctx, wr, q[i].off, q[i].len);
+  }
+  __atomic_store_n(u->sq_tail, tail + n, __ATOMIC_RELEASE);
+
+  unsigned left = n;
+  int submit = (int)n;
+  int ok = 1;
+  while (left > 0) {
+    long r = syscall(__NR_io_uring_enter, u->fd, submit, left,
+                     IORING_ENTER_GETEVENTS, NULL, 0);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0) {
+      /* pedidos que o kernel não consumiu saem da fila (sem SQPOLL ele só
+       * lê a fila dentro do enter); os já submetidos são esperados, para
+       * que nenhuma conclusão velha apareça num lote futuro e nenhum
+       * buffer seja tocado depois do retorno */
+      unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+      unsigned unsent = tail + n - head;
+      __atomic_store_n(u->sq_tail, head, __ATOMIC_RELEASE);
+      if (!uring_drain(u, left - unsent))
+        printf("io_uring: conclusões perdidas; anel desmontado.\n");
+      uring_free(ctx);
+      return -1;
+    }
+    submit = 0;
+    unsigned head = *u->cq_head;
+    unsigned ctail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != ctail; head++, left--) {
+      struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+      IoReq *rq = &q[cqe->user_data];
+      size_t got = cqe->res < 0 ? 0 : (size_t)cqe->res;
+      if (got < rq->len &&
+          !(wr ? dev_write(ctx, rq->off + (long)got, rq->buf + got,
+                           rq->len - got)
+               : dev_read(ctx, rq->off + (long)got, rq->buf + got,
+                          rq->len - got)))
+        ok = 0;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+  }
+  return ok;
+}
+#else
+struct Fat16Uring {
+  unsigned depth;
+};
+
+static void uring_free(Fat16Ctx *ctx) { ctx->uring = NULL; }
+
+static int uring_init(Fat16Ctx *ctx, unsigned depth) {
+  (void)ctx;
+  (void)depth;
+  return 0;
+}
+
+static int uring_round(Fat16Ctx *ctx, int wr, IoReq *q, unsigned n) {
+  (void)ctx;
+  (void)wr;
+  (void)q;
+  (void)n;
+  return -1;
+}
+#endif
+
+/* Executa os n pedidos do lote (leitura ou escrita). Retorna 1 se todos
+ * completaram. */
+static int io_batch(Fat16Ctx *ctx, int wr, IoReq *q, int n) {
+  int i = 0;
+  /* o anel é um só por contexto: leitores concorrentes se revezam a cada
+   * rodada, não a cada lote */
+  while (i < n && __atomic_load_n(&ctx->uring, __ATOMIC_ACQUIRE)) {
+    pthread_mutex_lock(&ctx->cache_lock);
+    int r = -1;
+    unsigned k = 0;
+    if (ctx->uring) { /* outro leitor pode ter desmontado o anel */
+      k = (unsigned)(n - i);
+      if (k > ctx->uring->depth)
+        k = ctx->uring->depth;
+      r = uring_round(ctx, wr, q + i, k);
+    }
+    pthread_mutex_unlock(&ctx->cache_lock);
+    if (r == 0)
+      return 0;
+    if (r < 0)
+      break; /* sem anel: esta rodada e o resto pela via síncrona */
+    i += (int)k;
+  }
+  for (; i < n; i++) {
+    int ok = wr ? img_write(ctx, q[i].off, q[i].buf, q[i].len)
+                : img_read(ctx, q[i].off, q[i].buf, q[i].len);
+    if (!ok)
+      return 0;
+  }
+  return 1;
+}
+
+static void img_sync(Fat16Ctx *ctx) {
+  if (ctx->map)
+    msync(ctx->map, ctx->map_size, MS_ASYNC);
+  else if (ctx->overlay)
+    ovl_sync(ctx);
+  else
+    fflush(ctx->img);
+}
+
+/* Mapeia o arquivo reservando endereço para o volume inteiro (o arquivo
+ * pode ser menor que o volume declarado no BPB). */
+static int map_image(Fat16Ctx *ctx) {
+  struct stat st;
+  if (fstat(fileno(ctx->img), &st) != 0)
+    return 0;
+  uint32_t total = (ctx->bpb.total_sectors_16 != 0)
+                       ? ctx->bpb.total_sectors_16
+                       : ctx->bpb.total_sectors_32;
+  size_t vol = (size_t)total * ctx->bpb.bytes_per_sector;
+  size_t len = ((size_t)st.st_size > vol) ? (size_t)st.st_size : vol;
+  if (len == 0)
+    return 0;
+  void *m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fileno(ctx->img), 0);
+  if (m == MAP_FAILED)
+    return 0;
+  ctx->map = (uint8_t *)m;
+  ctx->map_len = len;
+  ctx->map_size = (size_t)st.st_size;
+  return 1;
+}
+
+static int load_boot(Fat16Ctx *ctx) {
+  return img_read(ctx, 0, &ctx->bpb, sizeof(BootSector));
+}
+
+static int load_fat(Fat16Ctx *ctx) {
+  ctx->fat_size_bytes =
+      (uint32_t)ctx->bpb.fat_size_16 * (uint32_t)ctx->bpb.bytes_per_sector;
+  ctx->fat_dirty = (uint8_t *)calloc(ctx->bpb.fat_size_16 + 1u, 1);
+  if (!ctx->fat_dirty)
+    return 0;
+
+  long fat0_off =
+      (long)ctx->bpb.reserved_sectors * (long)ctx->bpb.bytes_per_sector;
+  if (ctx->map) {
+    /* FAT 0 usada direto no mapa */
+    ctx->fat = (uint16_t *)img_span(ctx, fat0_off, ctx->fat_size_bytes);
+    if (!ctx->fat)
+      return 0;
+  } else {
+    ctx->fat = (uint16_t *)malloc(ctx->fat_size_bytes);
+    if (!ctx->fat)
+      return 0;
+    if (ctx->lazy) {
+      /* nenhum setor lido ainda: fat_next traz os que a cadeia tocar */
+      ctx->fat_loaded = (uint8_t *)calloc(ctx->bpb.fat_size_16 + 1u, 1);
+      if (!ctx->fat_loaded)
+        return 0;
+      ctx->fat_pending = ctx->bpb.fat_size_16;
+    } else if (!img_read(ctx, fat0_off, ctx->fat, ctx->fat_size_bytes)) {
+      return 0;
+    }
+  }
+
+  ctx->fat_entries = ctx->fat_size_bytes / 2;
+  return 1;
+}
+
+/* ----- FAT sob demanda (FAT16_OPEN_LAZY) -----
+ * fat_loaded marca os setores da FAT 0 já lidos; fat_pending conta os que
+ * faltam. Só leituras acontecem com setores pendentes (alterações passam
+ * antes por fat_load_all, via need_free_index), então ler um setor nunca
+ * sobrescreve uma alteração. Leituras concorrentes se acertam em page_lock. */
+
+#define FAT_PAGE_SECTORS 8 /* setores lidos por falta (4 KiB com 512 B) */
+
+/* Lê os setores pendentes de [s, e), juntando os consecutivos. Um setor
+ * ilegível vira clusters ruins: a cadeia termina ali e nada é alocado nele. */
+static void fat_read_sectors(Fat16Ctx *ctx, uint32_t s, uint32_t e) {
+  uint32_t bps = ctx->bpb.bytes_per_sector;
+  long fat0_off = (long)ctx->bpb.reserved_sectors * (long)bps;
+  while (s < e) {
+    if (ctx->fat_loaded[s]) {
+      s++;
+      continue;
+    }
+    uint32_t r = s;
+    while (r < e && !ctx->fat_loaded[r])
+      r++;
+    uint8_t *dst = (uint8_t *)ctx->fat + (size_t)s * bps;
+    if (!img_read(ctx, fat0_off + (long)s * bps, dst, (size_t)(r - s) * bps)) {
+      printf("Falha leitura da FAT (setores %u a %u).\n", s, r - 1);
+      for (uint32_t i = 0; i < (r - s) * bps / 2; i++)
+        ((uint16_t *)dst)[i] = FAT16_BAD;
+    }
+    for (uint32_t i = s; i < r; i++)
+      __atomic_store_n(&ctx->fat_loaded[i], 1, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&ctx->fat_pending, r - s, __ATOMIC_RELEASE);
+    s = r;
+  }
+}
+
+static void fat_page_in(Fat16Ctx *ctx, uint32_t sector) {
+  uint32_t s = sector - sector % FAT_PAGE_SECTORS;
+  uint32_t e = s + FAT_PAGE_SECTORS;
+  if (e > ctx->bpb.fat_size_16)
+    e = ctx->bpb.fat_size_16;
+  pthread_mutex_lock(&ctx->page_lock);
+  fat_read_sectors(ctx, s, e);
+  pthread_mutex_unlock(&ctx->page_lock);
+}
+
+static void fat_load_all(Fat16Ctx *ctx) {
+  if (!__atomic_load_n(&ctx->fat_pending, __ATOMIC_ACQUIRE))
+    return;
+  pthread_mutex_lock(&ctx->page_lock);
+  fat_read_sectors(ctx, 0, ctx->bpb.fat_size_16);
+  pthread_mutex_unlock(&ctx->page_lock);
+}
+
+/* Próximo cluster da cadeia, contado em fat_walked. */
+static uint16_t fat_next(Fat16Ctx *ctx, uint16_t c) {
+  tl_fat_walked++;
+  if (__atomic_load_n(&ctx->fat_pending, __ATOMIC_RELAXED)) {
+    uint32_t sector = (uint32_t)c * 2 / ctx->bpb.bytes_per_sector;
+    if (sector < ctx->bpb.fat_size_16 &&
+        !__atomic_load_n(&ctx->fat_loaded[sector], __ATOMIC_ACQUIRE))
+      fat_page_in(ctx, sector);
+  }
+  return ctx->fat[c];
+}
+
+/*
+ * Grava de volta apenas os setores marcados em dirty[], juntando setores
+ * sujos consecutivos numa única escrita. src aponta para a cópia em RAM da
+ * região que começa em base; bytes limita o último setor (raiz parcial).
+ */
+static int write_dirty_sectors(Fat16Ctx *ctx, long base, const uint8_t *src,
+                               const uint8_t *dirty, uint32_t nsect,
+                               uint32_t bytes) {
+  uint32_t bps = ctx->bpb.bytes_per_sector;
+  uint32_t s = 0;
+  while (s < nsect) {
+    if (!dirty[s]) {
+      s++;
+      continue;
+    }
+    uint32_t e = s;
+    while (e < nsect && dirty[e])
+      e++;
+    uint32_t from = s * bps;
+    uint32_t to = e * bps;
+    if (to > bytes)
+      to = bytes;
+    if (!img_write(ctx, base + (long)from, src + from, to - from))
+      return 0;
+    s = e;
+  }
+  return 1;
+}
+
+static int save_fat(Fat16Ctx *ctx) {
+  long first =
+      (long)ctx->bpb.reserved_sectors * (long)ctx->bpb.bytes_per_sector;
+  for (int i = 0; i < ctx->bpb.num_fats; i++) {
+    if (ctx->map && i == 0)
+      continue; /* FAT 0 já foi alterada no próprio mapa */
+    long off = first + (long)i * (long)ctx->fat_size_bytes;
+    if (!write_dirty_sectors(ctx, off, (const uint8_t *)ctx->fat,
+                             ctx->fat_dirty, ctx->bpb.fat_size_16,
+                             ctx->fat_size_bytes))
+      return 0;
+  }
+  memset(ctx->fat_dirty, 0, ctx->bpb.fat_size_16);
+  return 1;
+}
+
+static int load_root(Fat16Ctx *ctx) {
+  uint32_t bytes_root = (uint32_t)ctx->bpb.root_entry_count * 32u;
+  ctx->root_dir_sectors =
+      (bytes_root + ctx->bpb.bytes_per_sector - 1) / ctx->bpb.bytes_per_sector;
+
+  long root_off = (long)(ctx->bpb.reserved_sectors +
+                         (ctx->bpb.num_fats * ctx->bpb.fat_size_16)) *
+                  (long)ctx->bpb.bytes_per_sector;
+
+  size_t root_bytes = ctx->bpb.root_entry_count * sizeof(DirectoryEntry);
+  ctx->root_dirty = (uint8_t *)calloc(ctx->root_dir_sectors + 1u, 1);
+  if (!ctx->root_dirty)
+    return 0;
+
+  if (ctx->map) {
+    ctx->root = (DirectoryEntry *)img_span(ctx, root_off, root_bytes);
+    if (!ctx->root)
+      return 0;
+  } else {
+    ctx->root = (DirectoryEntry *)malloc(root_bytes);
+    if (!ctx->root)
+      return 0;
+    /* lazy: lida junto com o índice de nomes, no primeiro uso */
+    if (!ctx->lazy && !img_read(ctx, root_off, ctx->root, root_bytes))
+      return 0;
+    ctx->root_pending = ctx->lazy;
+  }
+
+  ctx->first_data_sector = ctx->bpb.reserved_sectors +
+                           (ctx->bpb.num_fats * ctx->bpb.fat_size_16) +
+                           ctx->root_dir_sectors;
+  return 1;
+}
+
+static int save_root(Fat16Ctx *ctx) {
+  if (ctx->map) {
+    /* raiz alterada no próprio mapa */
+    memset(ctx->root_dirty, 0, ctx->root_dir_sectors);
+    return 1;
+  }
+  long root_off = (long)(ctx->bpb.reserved_sectors +
+                         (ctx->bpb.num_fats * ctx->bpb.fat_size_16)) *
+                  (long)ctx->bpb.bytes_per_sector;
+  if (!write_dirty_sectors(ctx, root_off, (const uint8_t *)ctx->root,
+                           ctx->root_dirty, ctx->root_dir_sectors,
+                           (uint32_t)ctx->bpb.root_entry_count * 32u))
+    return 0;
+  memset(ctx->root_dirty, 0, ctx->root_dir_sectors);
+  return 1;
+}
+
+/* ----- Journal de metadados (FAT16_OPEN_JOURNAL) -----
+ * Com o journal, as operações só marcam setores sujos da FAT e da raiz;
+ * a cada journal_ops operações (ou em flush/close) os setores sujos vão
+ * como uma transação para o arquivo "<imagem>.jnl":
+ *   1. os dados dos arquivos já gravados na imagem são levados ao disco;
+ *   2. registros de setor + registro de commit, e fdatasync do journal;
+ *   3. checkpoint: FAT (todas as cópias) e raiz gravadas na imagem;
+ *   4. o journal é truncado.
+ * Um crash entre 2 e 4 é desfeito em fat16_open reaplicando as transações
+ * completas; um crash antes de 2 perde só as operações do grupo. Clusters
+ * liberados não são reaproveitados antes do próximo commit, para que os
+ * dados de um arquivo apagado mas ainda vivo na imagem não sejam
+ * sobrescritos. Um commit que falha não conta: o grupo continua pendente,
+ * uma transação incompleta é cortada do journal e uma completa fica nele
+ * até um commit seguinte dar certo.
+ */
+#define JNL_MAGIC 0x4A363146u /* "F16J" */
+#define JNL_FAT 1u
+#define JNL_ROOT 2u
+#define JNL_COMMIT 3u
+
+typedef struct {
+  uint32_t magic;
+  uint32_t type;
+  uint32_t seq;
+  uint32_t index; /* setor (FAT/raiz) ou, no commit, nº de registros */
+  uint32_t len;   /* bytes de dados após o cabeçalho */
+  uint32_t crc;   /* CRC-32 dos dados */
+} JnlRecord;
+
+struct Fat16Journal {
+  int fd;
+  char path[512];
+  uint32_t every;   /* operações por commit */
+  uint32_t pending; /* operações desde o último commit */
+  uint32_t seq;
+  int frees_pending; /* houve cluster liberado no grupo atual */
+  uint64_t commits;
+};
+
+static uint32_t crc32_buf(const uint8_t *p, size_t n) {
+  static uint32_t table[256];
+  static int ready;
+  if (!ready) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+    ready = 1;
+  }
+  uint32_t c = 0xFFFFFFFFu;
+  for (size_t i = 0; i < n; i++)
+    c = table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+  return c ^ 0xFFFFFFFFu;
+}
+
+static long fat_copy_off(Fat16Ctx *ctx, int copy) {
+  return (long)ctx->bpb.reserved_sectors * (long)ctx->bpb.bytes_per_sector +
+         (long)copy * (long)ctx->bpb.fat_size_16 *
+             (long)ctx->bpb.bytes_per_sector;
+}
+
+static long root_area_off(Fat16Ctx *ctx) {
+  return fat_copy_off(ctx, ctx->bpb.num_fats);
+}
+
+/* Dados e metadados já gravados chegam ao disco (não só ao page cache). */
+static int img_durable(Fat16Ctx *ctx) {
+  int ok = 1;
+  if (ctx->bcache) {
+    pthread_mutex_lock(&ctx->cache_lock);
+    ok = bc_flush(ctx);
+    pthread_mutex_unlock(&ctx->cache_lock);
+  }
+  if (ctx->map)
+    return ok && msync(ctx->map, ctx->map_size, MS_SYNC) == 0;
+  fflush(ctx->img);
+  return ok && fdatasync(fileno(ctx->img)) == 0;
+}
+
+static int jnl_append(struct Fat16Journal *j, uint32_t type, uint32_t index,
+                      const uint8_t *data, uint32_t len) {
+  JnlRecord r = {JNL_MAGIC, type, j->seq, index, len,
+                 crc32_buf(data, len)};
+  return write(j->fd, &r, sizeof(r)) == (ssize_t)sizeof(r) &&
+         (len == 0 || write(j->fd, data, len) == (ssize_t)len);
+}
+
+/* Registra os setores sujos de uma área (FAT ou raiz); soma em *n. */
+static int jnl_log_area(Fat16Ctx *ctx, uint32_t type, const uint8_t *src,
+                        const uint8_t *dirty, uint32_t nsect, uint32_t bytes,
+                        uint32_t *n) {
+  uint32_t bps = ctx->bpb.bytes_per_sector;
+  for (uint32_t s = 0; s < nsect; s++) {
+    if (!dirty[s])
+      continue;
+    uint32_t len = (s + 1) * bps > bytes ? bytes - s * bps : bps;
+    if (!jnl_append(ctx->journal, type, s, src + (size_t)s * bps, len))
+      return 0;
+    (*n)++;
+  }
+  return 1;
+}
+
+/* Grava na imagem uma transação lida do journal (setor da FAT em todas as
+ * cópias, ou setor da raiz). */
+static int jnl_apply(Fat16Ctx *ctx, const JnlRecord *r, const uint8_t *data) {
+  uint32_t bps = ctx->bpb.bytes_per_sector;
+  if (r->len > bps)
+    return 0;
+  if (r->type == JNL_FAT) {
+    if (r->index >= ctx->bpb.fat_size_16)
+      return 0;
+    for (int i = 0; i < ctx->bpb.num_fats; i++)
+      if (!img_write(ctx, fat_copy_off(ctx, i) + (long)r->index * bps, data,
+                     r->len))
+        return 0;
+    return 1;
+  }
+  if (r->type == JNL_ROOT) {
+    uint32_t root_sectors =
+        ((uint32_t)ctx->bpb.root_entry_count * 32u + bps - 1) / bps;
+    if (r->index >= root_sectors)
+      return 0;
+    return img_write(ctx, root_area_off(ctx) + (long)r->index * bps, data,
+                     r->len);
+  }
+  return 0;
+}
+
+/*
+ * Reaplica as transações completas de "<imagem>.jnl", se existir, e o
+ * remove. Roda em fat16_open antes de carregar FAT e raiz, com ou sem
+ * FAT16_OPEN_JOURNAL. Retorna 0 só se a imagem não pôde ser atualizada.
+ */
+static int jnl_replay(Fat16Ctx *ctx, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 1;
+  uint32_t bps = ctx->bpb.bytes_per_sector;
+  uint32_t cap = 64, n = 0, applied = 0;
+  JnlRecord *recs = (JnlRecord *)malloc(sizeof(JnlRecord) * cap);
+  uint8_t *data = (uint8_t *)malloc((size_t)cap * bps);
+  int ok = recs && data;
+  JnlRecord r;
+  while (ok && read(fd, &r, sizeof(r)) == (ssize_t)sizeof(r)) {
+    if (r.magic != JNL_MAGIC || r.len > bps)
+      break; /* fim do journal válido (registro rasgado) */
+    if (r.type == JNL_COMMIT) {
+      if (n == 0 || r.index != n || recs[0].seq != r.seq)
+        break;
+      for (uint32_t i = 0; i < n && ok; i++)
+        ok = jnl_apply(ctx, &recs[i], data + (size_t)i * bps);
+      applied++;
+      n = 0;
+      continue;
+    }
+    if (n > 0 && recs[0].seq != r.seq)
+      n = 0; /* transação anterior sem commit: descartada */
+    if (n == cap) {
+      cap *= 2;
+      JnlRecord *nr = (JnlRecord *)realloc(recs, sizeof(JnlRecord) * cap);
+      uint8_t *nd = (uint8_t *)realloc(data, (size_t)cap * bps);
+      if (nr)
+        recs = nr;
+      if (nd)
+        data = nd;
+      if (!nr || !nd) {
+        ok = 0;
+        break;
+      }
+    }
+    uint8_t *dst = data + (size_t)n * bps;
+    if (read(fd, dst, r.len) != (ssize_t)r.len || crc32_buf(dst, r.len) != r.crc)
+      break;
+    recs[n++] = r;
+  }
+  close(fd);
+  free(recs);
+  free(data);
+  if (ok && applied > 0) {
+    ok = img_durable(ctx);
+    printf("Journal: %u transação(ões) reaplicada(s).\n", applied);
+  }
+  if (ok)
+    unlink(path);
+  return ok;
+}
+
+static int jnl_open(Fat16Ctx *ctx, const char *img_path, uint32_t every) {
+  struct Fat16Journal *j = (struct Fat16Journal *)calloc(1, sizeof(*j));
+  if (!j)
+    return 0;
+  snprintf(j->path, sizeof(j->path), "%s.jnl", img_path);
+  j->fd = open(j->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (j->fd < 0) {
+    free(j);
+    return 0;
+  }
+  j->every = every ? every : 64;
+  ctx->journal = j;
+  return 1;
+}
+
+/* Commit de grupo: passos 1–4 do comentário acima. */
+static int jnl_commit(Fat16Ctx *ctx) {
+  struct Fat16Journal *j = ctx->journal;
+  uint32_t n = 0;
+  /* fim da última transação completa (0, salvo se um checkpoint falhou) */
+  off_t start = lseek(j->fd, 0, SEEK_CUR);
+  j->seq++;
+  int ok = start >= 0 && img_durable(ctx) &&
+           jnl_log_area(ctx, JNL_FAT, (const uint8_t *)ctx->fat,
+                        ctx->fat_dirty, ctx->bpb.fat_size_16,
+                        ctx->fat_size_bytes, &n) &&
+           jnl_log_area(ctx, JNL_ROOT, (const uint8_t *)ctx->root,
+                        ctx->root_dirty, ctx->root_dir_sectors,
+                        (uint32_t)ctx->bpb.root_entry_count * 32u, &n);
+  if (ok && n > 0)
+    ok = jnl_append(j, JNL_COMMIT, n, NULL, 0) && fdatasync(j->fd) == 0;
+  if (!ok) {
+    /* registros rasgados esconderiam do replay as transações seguintes */
+    if (start >= 0 && ftruncate(j->fd, start) == 0)
+      lseek(j->fd, start, SEEK_SET);
+    return 0;
+  }
+  /* daqui em diante a transação está no journal: se o checkpoint falhar
+   * ela fica lá e o replay a refaz */
+  if (n > 0 && !(save_fat(ctx) && save_root(ctx) && img_durable(ctx)))
+    return 0;
+  if (ftruncate(j->fd, 0) != 0 || lseek(j->fd, 0, SEEK_SET) != 0)
+    return 0;
+  if (n > 0)
+    j->commits++;
+  j->pending = 0;
+  j->frees_pending = 0;
+  return 1;
+}
+
+static void jnl_close(Fat16Ctx *ctx) {
+  struct Fat16Journal *j = ctx->journal;
+  if (!j)
+    return;
+  /* vazio depois do último commit; se ele falhou, o que sobrou é só de
+   * transações completas, para o replay no próximo open */
+  int empty = lseek(j->fd, 0, SEEK_END) == 0;
+  close(j->fd);
+  if (empty)
+    unlink(j->path);
+  free(j);
+  ctx->journal = NULL;
+}
+
+/*
+ * Fim de uma operação que alterou FAT/raiz. Sem journal grava na hora
+ * (como sempre foi); com journal só conta a operação e faz o commit de
+ * grupo a cada journal_ops, ou já se force.
+ */
+static int meta_commit(Fat16Ctx *ctx, int force) {
+  if (!ctx->journal)
+    return save_fat(ctx) && save_root(ctx);
+  if (!force && ++ctx->journal->pending < ctx->journal->every)
+    return 1;
+  return jnl_commit(ctx);
+}
+
+/* Antes de alocar: clusters liberados no grupo atual ainda pertencem ao
+ * arquivo apagado na imagem em disco, então fecha o grupo primeiro. */
+static int meta_before_alloc(Fat16Ctx *ctx) {
+  if (ctx->journal && ctx->journal->frees_pending)
+    return jnl_commit(ctx);
+  return 1;
+}
+
+/* Marca como sujo o setor do diretório raiz que contém a entrada e. */
+static void root_touch(Fat16Ctx *ctx, const DirectoryEntry *e) {
+  uint32_t byte = (uint32_t)(e - ctx->root) * 32u;
+  ctx->root_dirty[byte / ctx->bpb.bytes_per_sector] = 1;
+}
+
+static void compute_derived(Fat16Ctx *ctx) {
+  ctx->total_sectors = (ctx->bpb.total_sectors_16 != 0)
+                           ? ctx->bpb.total_sectors_16
+                           : ctx->bpb.total_sectors_32;
+  ctx->cluster_size = (uint32_t)ctx->bpb.sectors_per_cluster *
+                      (uint32_t)ctx->bpb.bytes_per_sector;
+
+  uint32_t non_data =
+      (uint32_t)ctx->bpb.reserved_sectors +
+      (uint32_t)ctx->bpb.num_fats * (uint32_t)ctx->bpb.fat_size_16 +
+      (uint32_t)ctx->root_dir_sectors;
+  ctx->data_sectors =
+      (ctx->total_sectors > non_data) ? (ctx->total_sectors - non_data) : 0;
+  ctx->cluster_count = (ctx->bpb.sectors_per_cluster != 0)
+                           ? (ctx->data_sectors / ctx->bpb.sectors_per_cluster)
+                           : 0;
+  ctx->cluster_limit = ctx->cluster_count + 2;
+  if (ctx->cluster_limit > ctx->fat_entries)
+    ctx->cluster_limit = ctx->fat_entries;
+}
+
+static void decode_date(uint16_t d, int *day, int *mon, int *year) {
+  *day = d & 0x1F;
+  *mon = (d >> 5) & 0x0F;
+  *year = ((d >> 9) & 0x7F) + 1980;
+}
+static void decode_time(uint16_t t, int *hh, int *mm, int *ss) {
+  *ss = (t & 0x1F) * 2;
+  *mm = (t >> 5) & 0x3F;
+  *hh = (t >> 11) & 0x1F;
+}
+
+static uint16_t encode_date(int day, int mon, int year) {
+  return (uint16_t)(((year - 1980) << 9) | (mon << 5) | day);
+}
+static uint16_t encode_time(int hh, int mm, int ss) {
+  return (uint16_t)((hh << 11) | (mm << 5) | (ss / 2));
+}
+static void now_fat(uint16_t *d, uint16_t *t) {
+  time_t now = time(NULL);
+  struct tm *tmv = localtime(&now);
+  *d = encode_date(tmv->tm_mday, tmv->tm_mon + 1, tmv->tm_year + 1900);
+  *t = encode_time(tmv->tm_hour, tmv->tm_min, tmv->tm_sec);
+}
+
+void fat16_to83(const char *in, char name[8], char ext[3]) {
+  memset(name, ' ', 8);
+  memset(ext, ' ', 3);
+  const char *dot = strrchr(in, '.');
+  if (dot) {
+    int nlen = (int)(dot - in);
+    if (nlen > 8)
+      nlen = 8;
+    for (int i = 0; i < nlen; i++)
+      name[i] = (char)toupper((unsigned char)in[i]);
+    int elen = (int)strlen(dot + 1);
+    if (elen > 3)
+      elen = 3;
+    for (int i = 0; i < elen; i++)
+      ext[i] = (char)toupper((unsigned char)dot[1 + i]);
+  } else {
+    int nlen = (int)strlen(in);
+    if (nlen > 8)
+      nlen = 8;
+    for (int i = 0; i < nlen; i++)
+      name[i] = (char)toupper((unsigned char)in[i]);
+  }
+}
+
+static void make_readable(const DirectoryEntry *e, char out[13]) {
+  int p = 0;
+  for (int i = 0; i < 8 && e->filename[i] != ' '; i++)
+    out[p++] = e->filename[i];
+  if (e->extension[0] != ' ') {
+    out[p++] = '.';
+    for (int i = 0; i < 3 && e->extension[i] != ' '; i++)
+      out[p++] = e->extension[i];
+  }
+  out[p] = '\0';
+}
+
+static int entry_free(const DirectoryEntry *e) {
+  return (e->filename[0] == 0x00) || ((unsigned char)e->filename[0] == 0xE5);
+}
+static int entry_regular(const DirectoryEntry *e) {
+  if (entry_free(e))
+    return 0;
+  if (e->attributes & ATTR_VOLUME_ID)
+    return 0;
+  if (e->attributes & ATTR_DIRECTORY)
+    return 0;
+  return 1;
+}
+
+/* Entrada com nome próprio: arquivo ou subdiretório (sem rótulo de volume,
+ * LFN, "." e ".."). */
+static int entry_named(const DirectoryEntry *e) {
+  if (entry_free(e))
+    return 0;
+  if (e->attributes & ATTR_VOLUME_ID)
+    return 0;
+  return e->filename[0] != '.';
+}
+
+static long cluster_offset(Fat16Ctx *ctx, uint16_t cluster) {
+  uint32_t sector =
+      ((uint32_t)(cluster - 2) * (uint32_t)ctx->bpb.sectors_per_cluster) +
+      ctx->first_data_sector;
+  return (long)sector * (long)ctx->bpb.bytes_per_sector;
+}
+
+/* ===== Kernels de varredura (SIMD) =====
+ * Varreduras lineares da FAT e de vetores de DirectoryEntry, em três
+ * versões (escalar, SSE2 e AVX2) escolhidas uma vez em tempo de execução
+ * conforme a CPU. FAT16_SIMD=scalar|sse2|avx2 no ambiente força uma delas
+ * (se a CPU suportar), para comparar e conferir resultados.
+ *   zero_bits: bit c de bits[] = (fat[c] == 0) para nwords*64 entradas;
+ *              retorna quantas são zero (contagem de livres).
+ *   dir_match: 1ª entrada de ents[0..n) com o nome 8.3 (11 bytes) n83 ou
+ *              com a marca de fim (0x00); n se nenhuma.
+ *   free_bits: liga em bits[] as entradas livres (0x00 ou 0xE5); retorna
+ *              quantas.
+ */
+typedef struct {
+  const char *name;
+  uint32_t (*zero_bits)(const uint16_t *fat, uint32_t nwords, uint64_t *bits);
+  uint32_t (*dir_match)(const DirectoryEntry *ents, uint32_t n,
+                        const char n83[11]);
+  uint32_t (*free_bits)(const DirectoryEntry *ents, uint32_t n,
+                        uint64_t *bits);
+} ScanKernels;
+
+static uint32_t zero_bits_scalar(const uint16_t *fat, uint32_t nwords,
+                                 uint64_t *bits) {
+  uint32_t count = 0;
+  for (uint32_t w = 0; w < nwords; w++) {
+    uint64_t m = 0;
+    for (uint32_t i = 0; i < 64; i++)
+      m |= (uint64_t)(fat[w * 64 + i] == 0) << i;
+    bits[w] = m;
+    count += (uint32_t)__builtin_popcountll(m);
+  }
+  return count;
+}
+
+static uint32_t dir_match_scalar(const DirectoryEntry *ents, uint32_t n,
+                                 const char n83[11]) {
+  for (uint32_t i = 0; i < n; i++)
+    if (ents[i].filename[0] == 0x00 ||
+        (memcmp(ents[i].filename, n83, 8) == 0 &&
+         memcmp(ents[i].extension, n83 + 8, 3) == 0))
+      return i;
+  return n;
+}
+
+static uint32_t free_bits_scalar(const DirectoryEntry *ents, uint32_t n,
+                                 uint64_t *bits) {
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < n; i++)
+    if (entry_free(&ents[i])) {
+      bits[i >> 6] |= 1ull << (i & 63);
+      count++;
+    }
+  return count;
+}
+
+#ifdef SCAN_X86
+
+__attribute__((target("sse2"))) static uint32_t
+zero_bits_sse2(const uint16_t *fat, uint32_t nwords, uint64_t *bits) {
+  const __m128i z = _mm_setzero_si128();
+  uint32_t count = 0;
+  for (uint32_t w = 0; w < nwords; w++) {
+    const __m128i *p = (const __m128i *)(fat + (size_t)w * 64);
+    uint64_t m = 0;
+    for (int k = 0; k < 4; k++) {
+      /* 16 entradas → 16 bytes 0x00/0xFF → 16 bits */
+      __m128i a = _mm_cmpeq_epi16(_mm_loadu_si128(p + 2 * k), z);
+      __m128i b = _mm_cmpeq_epi16(_mm_loadu_si128(p + 2 * k + 1), z);
+      m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_packs_epi16(a, b))
+           << (16 * k);
+    }
+    bits[w] = m;
+    count += (uint32_t)__builtin_popcountll(m);
+  }
+  return count;
+}
+
+__attribute__((target("sse2"))) static uint32_t
+dir_match_sse2(const DirectoryEntry *ents, uint32_t n, const char n83[11]) {
+  char pat[16] = {0};
+  memcpy(pat, n83, 11);
+  const __m128i vp = _mm_loadu_si128((const __m128i *)pat);
+  const __m128i z = _mm_setzero_si128();
+  for (uint32_t i = 0; i < n; i++) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&ents[i]);
+    int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(v, vp));
+    int nul = _mm_movemask_epi8(_mm_cmpeq_epi8(v, z));
+    if ((eq & 0x7FF) == 0x7FF || (nul & 1))
+      return i;
+  }
+  return n;
+}
+
+/* O 1º byte de 4 entradas vai para o byte baixo de 4 lanes de 32 bits. */
+__attribute__((target("sse2"))) static uint32_t
+free_bits_sse2(const DirectoryEntry *ents, uint32_t n, uint64_t *bits) {
+  const __m128i lo = _mm_set1_epi32(0xFF);
+  const __m128i del = _mm_set1_epi32(0xE5);
+  uint32_t count = 0, i = 0;
+  for (; i + 4 <= n; i += 4) {
+    int32_t d[4];
+    for (int k = 0; k < 4; k++)
+      memcpy(&d[k], &ents[i + (uint32_t)k], 4);
+    __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)d), lo);
+    __m128i f = _mm_or_si128(_mm_cmpeq_epi32(v, _mm_setzero_si128()),
+                             _mm_cmpeq_epi32(v, del));
+    uint64_t m = (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(f));
+    bits[i >> 6] |= m << (i & 63);
+    count += (uint32_t)__builtin_popcountll(m);
+  }
+  uint64_t tail[1] = {0};
+  uint32_t rest = free_bits_scalar(ents + i, n - i, tail);
+  if (rest)
+    bits[i >> 6] |= tail[0] << (i & 63);
+  return count + rest;
+}
+
+__attribute__((target("avx2"))) static uint32_t
+zero_bits_avx2(const uint16_t *fat, uint32_t nwords, uint64_t *bits) {
+  const __m256i z = _mm256_setzero_si256();
+  uint32_t count = 0;
+  for (uint32_t w = 0; w < nwords; w++) {
+    const __m256i *p = (const __m256i *)(fat + (size_t)w * 64);
+    uint64_t m = 0;
+    for (int k = 0; k < 2; k++) {
+      /* 32 entradas; packs intercala as metades de 128 bits, o permute
+       * devolve a ordem */
+      __m256i a = _mm256_cmpeq_epi16(_mm256_loadu_si256(p + 2 * k), z);
+      __m256i b = _mm256_cmpeq_epi16(_mm256_loadu_si256(p + 2 * k + 1), z);
+      __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+      m |= (uint64_t)(uint32_t)_mm256_movemask_epi8(v) << (32 * k);
+    }
+    bits[w] = m;
+    count += (uint32_t)__builtin_popcountll(m);
+  }
+  return count;
+}
+
+/* Duas entradas por vetor: os 16 primeiros bytes de cada uma. */
+__attribute__((target("avx2"))) static uint32_t
+dir_match_avx2(const DirectoryEntry *ents, uint32_t n, const char n83[11]) {
+  char pat[16] = {0};
+  memcpy(pat, n83, 11);
+  const __m128i p1 = _mm_loadu_si128((const __m128i *)pat);
+  const __m256i vp = _mm256_inserti128_si256(_mm256_castsi128_si256(p1), p1, 1);
+  const __m256i z = _mm256_setzero_si256();
+  uint32_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i a = _mm_loadu_si128((const __m128i *)&ents[i]);
+    __m128i b = _mm_loadu_si128((const __m128i *)&ents[i + 1]);
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(a), b, 1);
+    uint32_t eq = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vp));
+    uint32_t nul = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, z));
+    if ((eq & 0x7FF) == 0x7FF || (nul & 1))
+      return i;
+    if (((eq >> 16) & 0x7FF) == 0x7FF || (nul & 0x10000))
+      return i + 1;
+  }
+  return i + dir_match_scalar(ents + i, n - i, n83);
+}
+
+/* Gather do 1º dword de 8 entradas (passo de 32 bytes). */
+__attribute__((target("avx2"))) static uint32_t
+free_bits_avx2(const DirectoryEntry *ents, uint32_t n, uint64_t *bits) {
+  const __m256i idx = _mm256_setr_epi32(0, 8, 16, 24, 32, 40, 48, 56);
+  const __m256i lo = _mm256_set1_epi32(0xFF);
+  const __m256i del = _mm256_set1_epi32(0xE5);
+  uint32_t count = 0, i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_i32gather_epi32((const int *)&ents[i], idx, 4);
+    v = _mm256_and_si256(v, lo);
+    __m256i f = _mm256_or_si256(_mm256_cmpeq_epi32(v, _mm256_setzero_si256()),
+                                _mm256_cmpeq_epi32(v, del));
+    uint64_t m = (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(f));
+    bits[i >> 6] |= m << (i & 63);
+    count += (uint32_t)__builtin_popcountll(m);
+  }
+  uint64_t tail[1] = {0};
+  uint32_t rest = free_bits_scalar(ents + i, n - i, tail);
+  if (rest)
+    bits[i >> 6] |= tail[0] << (i & 63);
+  return count + rest;
+}
+#endif
+
+static ScanKernels scan_k = {"escalar", zero_bits_scalar, dir_match_scalar,
+                             free_bits_scalar};
+static pthread_once_t scan_once = PTHREAD_ONCE_INIT;
+
+static void scan_pick(void) {
+#ifdef SCAN_X86
+  const char *force = getenv("FAT16_SIMD");
+  __builtin_cpu_init();
+  int sse2 = __builtin_cpu_supports("sse2");
+  int avx2 = __builtin_cpu_supports("avx2");
+  if (force && strcmp(force, "scalar") == 0)
+    sse2 = avx2 = 0;
+  else if (force && strcmp(force, "sse2") == 0)
+    avx2 = 0;
+  if (avx2) {
+    ScanKernels k = {"avx2", zero_bits_avx2, dir_match_avx2, free_bits_avx2};
+    scan_k = k;
+  } else if (sse2) {
+    ScanKernels k = {"sse2", zero_bits_sse2, dir_match_sse2, free_bits_sse2};
+    scan_k = k;
+  }
+#endif
+}
+
+static const ScanKernels *scan_kernels(void) {
+  pthread_once(&scan_once, scan_pick);
+  return &scan_k;
+}
+
+const char *fat16_scan_impl(void) { return scan_kernels()->name; }
+
+/* ===== Índice de nomes do diretório raiz =====
+ * Tabela hash encadeada (por índice) sobre os 11 bytes do nome 8.3 e bitmap
+ * de entradas livres. A entrada livre devolvida é sempre a de menor índice,
+ * como na varredura linear, para não gravar nada depois de um marcador 0x00.
+ */
+
+static uint32_t name_hash(const char *n83) {
+  uint32_t h = 2166136261u; /* FNV-1a */
+  for (int i = 0; i < 11; i++) {
+    h ^= (uint8_t)n83[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void name_index_add(Fat16Ctx *ctx, int idx) {
+  uint32_t b = name_hash(ctx->root[idx].filename) & ctx->name_mask;
+  ctx->name_next[idx] = ctx->name_head[b];
+  ctx->name_head[b] = idx;
+}
+
+static void name_index_del(Fat16Ctx *ctx, int idx) {
+  int32_t *pp = &ctx->name_head[name_hash(ctx->root[idx].filename) &
+                                ctx->name_mask];
+  while (*pp >= 0) {
+    if (*pp == idx) {
+      *pp = ctx->name_next[idx];
+      return;
+    }
+    pp = &ctx->name_next[*pp];
+  }
+}
+
+static void slot_mark(Fat16Ctx *ctx, int idx, int is_free) {
+  uint64_t bit = 1ull << (idx & 63);
+  if (is_free)
+    ctx->slot_free[idx >> 6] |= bit;
+  else
+    ctx->slot_free[idx >> 6] &= ~bit;
+}
+
+/* Aloca o índice; o preenchimento (fill_name_index) lê a raiz inteira e,
+ * no modo lazy, fica para o primeiro uso. */
+static int alloc_name_index(Fat16Ctx *ctx) {
+  uint32_t n = ctx->bpb.root_entry_count;
+  uint32_t buckets = 16;
+  while (buckets < 2 * n)
+    buckets <<= 1;
+  ctx->name_mask = buckets - 1;
+  ctx->slot_words = (n + 63) / 64;
+
+  ctx->name_head = (int32_t *)malloc(sizeof(int32_t) * buckets);
+  ctx->name_next = (int32_t *)malloc(sizeof(int32_t) * (n ? n : 1));
+  ctx->slot_free = (uint64_t *)calloc(ctx->slot_words + 1, sizeof(uint64_t));
+  return ctx->name_head && ctx->name_next && ctx->slot_free;
+}
+
+static void fill_name_index(Fat16Ctx *ctx) {
+  uint32_t n = ctx->bpb.root_entry_count;
+  uint32_t buckets = ctx->name_mask + 1;
+  for (uint32_t b = 0; b < buckets; b++)
+    ctx->name_head[b] = -1;
+  for (uint32_t i = 0; i < n; i++)
+    ctx->name_next[i] = -1;
+  scan_kernels()->free_bits(ctx->root, n, ctx->slot_free);
+  tl_dirents += n;
+  /* só as ocupadas entram no hash */
+  for (uint32_t w = 0; w < ctx->slot_words; w++) {
+    uint64_t m = ~ctx->slot_free[w];
+    if (w == ctx->slot_words - 1 && (n & 63))
+      m &= (1ull << (n & 63)) - 1;
+    for (; m; m &= m - 1) {
+      int i = (int)((w << 6) + (uint32_t)__builtin_ctzll(m));
+      if (entry_named(&ctx->root[i]))
+        name_index_add(ctx, i);
+    }
+  }
+}
+
+#define FIND_FILE 1
+#define FIND_DIR 2
+#define FIND_ANY (FIND_FILE | FIND_DIR)
+
+/* Entrada da raiz com o nome 8.3 já convertido (11 bytes), filtrada por
+ * tipo (FIND_*). */
+static DirectoryEntry *find_in_root(Fat16Ctx *ctx, const char n83[11],
+                                    int want) {
+  int32_t i = ctx->name_head[name_hash(n83) & ctx->name_mask];
+  for (; i >= 0; i = ctx->name_next[i]) {
+    DirectoryEntry *e = &ctx->root[i];
+    tl_dirents++;
+    if (memcmp(e->filename, n83, 8) != 0 ||
+        memcmp(e->extension, n83 + 8, 3) != 0)
+      continue;
+    if (want & ((e->attributes & ATTR_DIRECTORY) ? FIND_DIR : FIND_FILE))
+      return e;
+  }
+  return NULL;
+}
+
+static DirectoryEntry *find_by_name(Fat16Ctx *ctx, const char *name83) {
+  char n83[11];
+  fat16_to83(name83, n83, n83 + 8);
+  return find_in_root(ctx, n83, FIND_FILE);
+}
+
+/* Existe qualquer entrada (arquivo ou pasta) com esse nome na raiz? */
+static int name_taken(Fat16Ctx *ctx, const char *name83) {
+  char n83[11];
+  fat16_to83(name83, n83, n83 + 8);
+  return find_in_root(ctx, n83, FIND_ANY) != NULL;
+}
+
+static DirectoryEntry *find_free_dir(Fat16Ctx *ctx) {
+  for (uint32_t w = 0; w < ctx->slot_words; w++) {
+    if (ctx->slot_free[w])
+      return &ctx->root[(w << 6) + (uint32_t)__builtin_ctzll(ctx->slot_free[w])];
+  }
+  return NULL;
+}
+
+/* ===== Índice de clusters livres =====
+ * Bitmap de dois níveis sobre ctx->fat: free_map tem um bit por cluster e
+ * free_sum um bit por palavra de free_map. Achar o próximo livre custa no
+ * máximo uma varredura de free_sum (<= 16 palavras para 65536 clusters). */
+
+/* Como no índice de nomes: alocação na abertura, preenchimento (que
+ * percorre a FAT inteira) adiável até a primeira alteração. */
+static int alloc_free_index(Fat16Ctx *ctx) {
+  ctx->free_words = (ctx->cluster_limit + 63) / 64;
+  uint32_t sum_words = (ctx->free_words + 63) / 64;
+  ctx->free_map = (uint64_t *)calloc(ctx->free_words + 1, sizeof(uint64_t));
+  ctx->free_sum = (uint64_t *)calloc(sum_words + 1, sizeof(uint64_t));
+  return ctx->free_map && ctx->free_sum;
+}
+
+static void fill_free_index(Fat16Ctx *ctx) {
+  /* palavras inteiras pelo kernel, o resto entrada a entrada */
+  uint32_t full = ctx->cluster_limit / 64;
+  ctx->free_count = scan_kernels()->zero_bits(ctx->fat, full, ctx->free_map);
+  for (uint32_t c = full * 64; c < ctx->cluster_limit; c++) {
+    if (ctx->fat[c] != FAT16_FREE)
+      continue;
+    ctx->free_map[c >> 6] |= 1ull << (c & 63);
+    ctx->free_count++;
+  }
+  /* clusters 0 e 1 são reservados, nunca livres */
+  for (uint32_t c = 0; c < 2 && c < ctx->cluster_limit; c++)
+    if (ctx->free_map[0] & (1ull << c)) {
+      ctx->free_map[0] &= ~(1ull << c);
+      ctx->free_count--;
+    }
+  for (uint32_t w = 0; w < ctx->free_words; w++)
+    if (ctx->free_map[w])
+      ctx->free_sum[w >> 6] |= 1ull << (w & 63);
+}
+
+static void freemap_mark(Fat16Ctx *ctx, uint32_t c, int is_free) {
+  uint32_t w = c >> 6;
+  uint64_t bit = 1ull << (c & 63);
+  int was_free = (ctx->free_map[w] & bit) != 0;
+  if (was_free == is_free)
+    return;
+  if (is_free) {
+    ctx->free_map[w] |= bit;
+    ctx->free_sum[w >> 6] |= 1ull << (w & 63);
+    ctx->free_count++;
+  } else {
+    ctx->free_map[w] &= ~bit;
+    if (ctx->free_map[w] == 0)
+      ctx->free_sum[w >> 6] &= ~(1ull << (w & 63));
+    ctx->free_count--;
+  }
+}
+
+/* Toda escrita na FAT em RAM passa por aqui para manter o índice em dia. */
+static void fat_set(Fat16Ctx *ctx, uint16_t c, uint16_t value) {
+  if (ctx->fat[c] == value)
+    return;
+  ctx->fat[c] = value;
+  ctx->fat_dirty[((uint32_t)c * 2u) / ctx->bpb.bytes_per_sector] = 1;
+  if (value == FAT16_FREE && ctx->journal)
+    ctx->journal->frees_pending = 1;
+  if (c >= 2 && c < ctx->cluster_limit)
+    freemap_mark(ctx, c, value == FAT16_FREE);
+}
+
+static uint16_t find_free_cluster_from(Fat16Ctx *ctx, uint32_t start) {
+  if (start < 2)
+    start = 2;
+  if (start >= ctx->cluster_limit || ctx->free_count == 0)
+    return 0;
+
+  uint32_t w = start >> 6;
+  uint64_t m = ctx->free_map[w] & (~0ull << (start & 63));
+  if (m)
+    return (uint16_t)((w << 6) + (uint32_t)__builtin_ctzll(m));
+
+  /* palavra atual esgotada: pula direto para a próxima palavra com livres */
+  uint32_t next = w + 1;
+  uint32_t sum_words = (ctx->free_words + 63) / 64;
+  for (uint32_t sw = next >> 6; sw < sum_words; sw++) {
+    uint64_t sm = ctx->free_sum[sw];
+    if (sw == (next >> 6))
+      sm &= ~0ull << (next & 63);
+    if (sm) {
+      uint32_t fw = (sw << 6) + (uint32_t)__builtin_ctzll(sm);
+      return (uint16_t)((fw << 6) + (uint32_t)__builtin_ctzll(ctx->free_map[fw]));
+    }
+  }
+  return 0;
+}
+
+/* Primeiro cluster ocupado (ou cluster_limit) a partir de c. */
+static uint32_t find_used_cluster_from(Fat16Ctx *ctx, uint32_t c) {
+  while (c < ctx->cluster_limit) {
+    uint32_t w = c >> 6;
+    uint64_t m = ~ctx->free_map[w] & (~0ull << (c & 63));
+    if (m) {
+      c = (w << 6) + (uint32_t)__builtin_ctzll(m);
+      break;
+    }
+    c = (w + 1) << 6;
+  }
+  return (c < ctx->cluster_limit) ? c : ctx->cluster_limit;
+}
+
+typedef struct {
+  uint16_t start;
+  uint16_t len;
+} Extent;
+
+static int extent_by_len_desc(const void *a, const void *b) {
+  const Extent *x = (const Extent *)a, *y = (const Extent *)b;
+  if (x->len != y->len)
+    return (x->len < y->len) ? 1 : -1;
+  return (x->start > y->start) - (x->start < y->start);
+}
+static int extent_by_start(const void *a, const void *b) {
+  const Extent *x = (const Extent *)a, *y = (const Extent *)b;
+  return (x->start > y->start) - (x->start < y->start);
+}
+
+/*
+ * Aloca n clusters tentando manter o arquivo no menor número de extents:
+ *  1) best fit: a menor corrida livre que comporta o arquivo inteiro;
+ *  2) senão, usa as maiores corridas primeiro (empate → menor endereço)
+ *     e encadeia as partes em ordem crescente de endereço.
+ * Retorna o primeiro cluster (0 se não houver espaço) e, opcionalmente, a
+ * quantidade de extents usados.
+ */
+static uint16_t allocate_chain(Fat16Ctx *ctx, int n, uint16_t *out_chain,
+                               int *out_extents) {
+  if (n <= 0 || (uint32_t)n > ctx->free_count)
+    return 0;
+
+  int cap = 64, nruns = 0;
+  Extent *runs = (Extent *)malloc(sizeof(Extent) * (size_t)cap);
+  if (!runs)
+    return 0;
+
+  int best = -1;
+  uint32_t c = find_free_cluster_from(ctx, 2);
+  while (c != 0) {
+    uint32_t end = find_used_cluster_from(ctx, c);
+    if (nruns == cap) {
+      cap *= 2;
+      Extent *tmp = (Extent *)realloc(runs, sizeof(Extent) * (size_t)cap);
+      if (!tmp) {
+        free(runs);
+        return 0;
+      }
+      runs = tmp;
+    }
+    runs[nruns].start = (uint16_t)c;
+    runs[nruns].len = (uint16_t)(end - c);
+    if (runs[nruns].len >= n && (best < 0 || runs[nruns].len < runs[best].len))
+      best = nruns;
+    nruns++;
+    c = (end < ctx->cluster_limit) ? find_free_cluster_from(ctx, end) : 0;
+  }
+
+  int used = 0;
+  if (best >= 0) {
+    runs[0].start = runs[best].start;
+    runs[0].len = (uint16_t)n;
+    used = 1;
+  } else {
+    qsort(runs, (size_t)nruns, sizeof(Extent), extent_by_len_desc);
+    int left = n;
+    while (left > 0 && used < nruns) {
+      if (runs[used].len > left)
+        runs[used].len = (uint16_t)left;
+      left -= runs[used].len;
+      used++;
+    }
+    qsort(runs, (size_t)used, sizeof(Extent), extent_by_start);
+  }
+
+  int k = 0;
+  for (int r = 0; r < used; r++)
+    for (uint16_t i = 0; i < runs[r].len; i++)
+      out_chain[k++] = (uint16_t)(runs[r].start + i);
+  free(runs);
+
+  for (int i = 0; i < n - 1; i++)
+    fat_set(ctx, out_chain[i], out_chain[i + 1]);
+  fat_set(ctx, out_chain[n - 1], FAT16_EOF);
+  if (out_extents)
+    *out_extents = used;
+  return out_chain[0];
+}
+
+/* Quantidade de corridas fisicamente contíguas na cadeia iniciada em c. */
+static uint32_t chain_extents(Fat16Ctx *ctx, uint16_t c) {
+  uint32_t extents = 0, steps = 0;
+  uint16_t prev = 0;
+  while (c >= 2 && c < ctx->cluster_limit) {
+    if (prev == 0 || c != prev + 1)
+      extents++;
+    prev = c;
+    c = fat_next(ctx, c);
+    if (++steps > ctx->cluster_count + 8)
+      break;
+  }
+  return extents;
+}
+
+/*
+ * Percorre a cadeia de e em corridas de clusters fisicamente contíguos e
+ * chama fn(ctx, arg, off, len) para cada uma (off = offset na imagem, len já
+ * limitado ao tamanho do arquivo). Retorna 0 se a cadeia estiver corrompida
+ * ou se fn falhar.
+ */
+typedef int (*RunFn)(Fat16Ctx *ctx, void *arg, long off, uint32_t len);
+
+static int walk_runs(Fat16Ctx *ctx, const DirectoryEntry *e, RunFn fn,
+                     void *arg) {
+  uint32_t sz = e->file_size, got = 0, steps = 0;
+  uint16_t c = e->first_cluster_low;
+  while (got < sz) {
+    /* antes do limite: BAD (0xFFF7) também está fora dele */
+    if (c == FAT16_BAD) {
+      printf("Cluster BAD.\n");
+      return 0;
+    }
+    if (c < 2 || c >= ctx->cluster_limit) {
+      printf("Cluster fora do limite.\n");
+      return 0;
+    }
+
+    uint16_t run_start = c;
+    uint32_t run_bytes = ctx->cluster_size;
+    while (got + run_bytes < sz) {
+      uint16_t next = fat_next(ctx, c);
+      if (next == FAT16_FREE) {
+        printf("Cadeia interrompida.\n");
+        return 0;
+      }
+      if (++steps > ctx->cluster_count + 8) {
+        printf("Loop suspeito.\n");
+        return 0;
+      }
+      c = next;
+      if (c != (uint16_t)(run_start + run_bytes / ctx->cluster_size))
+        break;
+      run_bytes += ctx->cluster_size;
+    }
+
+    uint32_t len = sz - got;
+    if (len > run_bytes)
+      len = run_bytes;
+    if (!fn(ctx, arg, cluster_offset(ctx, run_start), len))
+      return 0;
+    got += len;
+  }
+  return 1;
+}
+
+typedef struct {
+  Fat16Span *spans;
+  int max;
+  int n;
+} SpanRun;
+
+static int span_run(Fat16Ctx *ctx, void *arg, long off, uint32_t len) {
+  SpanRun *sr = (SpanRun *)arg;
+  const uint8_t *p = img_span(ctx, off, len);
+  if (!p) {
+    printf("Falha leitura.\n");
+    return 0;
+  }
+  if (sr->n < sr->max) {
+    sr->spans[sr->n].data = p;
+    sr->spans[sr->n].len = len;
+  }
+  sr->n++;
+  return 1;
+}
+
+static int print_run(Fat16Ctx *ctx, void *arg, long off, uint32_t len) {
+  (void)arg;
+  const uint8_t *p = img_span(ctx, off, len);
+  if (!p) {
+    printf("Falha leitura.\n");
+    return 0;
+  }
+  fwrite(p, 1, len, stdout);
+  return 1;
+}
+
+/* ===== Índices sob demanda e trava do contexto =====
+ * Sem FAT16_OPEN_LAZY os dois índices já estão prontos ao abrir. No modo
+ * lazy, leituras montam só o de nomes (lendo a raiz) e alterações também o
+ * de livres (lendo o resto da FAT); vários leitores podem chegar juntos,
+ * então a montagem é feita sob dcache_lock e publicada pelo flag. */
+
+/* Raiz adiada pelo modo lazy. Se não puder ser lida, fica vazia e sem
+ * entradas livres: nada é criado por cima do que está no disco. */
+static void root_load(Fat16Ctx *ctx) {
+  long root_off = (long)(ctx->bpb.reserved_sectors +
+                         (ctx->bpb.num_fats * ctx->bpb.fat_size_16)) *
+                  (long)ctx->bpb.bytes_per_sector;
+  size_t root_bytes = ctx->bpb.root_entry_count * sizeof(DirectoryEntry);
+  ctx->root_pending = 0;
+  if (img_read(ctx, root_off, ctx->root, root_bytes)) {
+    fill_name_index(ctx);
+    return;
+  }
+  printf("Falha leitura do diretório raiz.\n");
+  memset(ctx->root, 0, root_bytes);
+  fill_name_index(ctx);
+  memset(ctx->slot_free, 0, (ctx->slot_words + 1) * sizeof(uint64_t));
+}
+
+static void need_name_index(Fat16Ctx *ctx) {
+  if (__atomic_load_n(&ctx->names_ready, __ATOMIC_ACQUIRE))
+    return;
+  pthread_mutex_lock(&ctx->dcache_lock);
+  if (!ctx->names_ready) {
+    if (ctx->root_pending)
+      root_load(ctx);
+    else
+      fill_name_index(ctx);
+    __atomic_store_n(&ctx->names_ready, 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&ctx->dcache_lock);
+}
+
+static void need_free_index(Fat16Ctx *ctx) {
+  if (__atomic_load_n(&ctx->free_ready, __ATOMIC_ACQUIRE))
+    return;
+  pthread_mutex_lock(&ctx->dcache_lock);
+  if (!ctx->free_ready) {
+    fat_load_all(ctx);
+    fill_free_index(ctx);
+    __atomic_store_n(&ctx->free_ready, 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&ctx->dcache_lock);
+}
+
+/* Trava do contexto: leituras em paralelo, alterações em série. */
+static void ctx_rdlock(Fat16Ctx *ctx) {
+  pthread_rwlock_rdlock(&ctx->lock);
+  need_name_index(ctx);
+}
+static void ctx_wrlock(Fat16Ctx *ctx) {
+  pthread_rwlock_wrlock(&ctx->lock);
+  need_name_index(ctx);
+  need_free_index(ctx);
+}
+static void ctx_unlock(Fat16Ctx *ctx) { pthread_rwlock_unlock(&ctx->lock); }
+
+/* ===== Cache de extents (fat16_pread) =====
+ * Para cada arquivo lido por fat16_pread guarda a cadeia já reduzida a
+ * extents (cluster lógico inicial, cluster físico, tamanho). Achar o cluster
+ * de um offset vira uma busca binária. Poucos arquivos ficam em cache ao
+ * mesmo tempo; a substituição é circular. Delete/create invalidam pelo
+ * primeiro cluster do arquivo.
+ */
+#define EXT_CACHE_FILES 64
+
+typedef struct {
+  uint32_t file_cluster; /* índice do 1º cluster do extent dentro do arquivo */
+  uint16_t start;        /* cluster físico */
+  uint16_t len;          /* clusters */
+} FileExtent;
+
+typedef struct {
+  uint16_t first; /* 1º cluster do arquivo (0 → posição vazia) */
+  uint32_t count;
+  FileExtent *ext;
+} ExtentList;
+
+struct Fat16ExtCache {
+  ExtentList files[EXT_CACHE_FILES];
+  int next_victim;
+};
+
+static void ext_cache_invalidate(Fat16Ctx *ctx, uint16_t first) {
+  if (!ctx->ext_cache || first == 0)
+    return;
+  for (int i = 0; i < EXT_CACHE_FILES; i++) {
+    ExtentList *l = &ctx->ext_cache->files[i];
+    if (l->first == first) {
+      free(l->ext);
+      memset(l, 0, sizeof(*l));
+    }
+  }
+}
+
+static void ext_cache_free(Fat16Ctx *ctx) {
+  if (!ctx->ext_cache)
+    return;
+  for (int i = 0; i < EXT_CACHE_FILES; i++)
+    free(ctx->ext_cache->files[i].ext);
+  free(ctx->ext_cache);
+  ctx->ext_cache = NULL;
+}
+
+/* Monta (ou devolve do cache) a lista de extents de e. */
+static ExtentList *ext_cache_get(Fat16Ctx *ctx, const DirectoryEntry *e) {
+  uint16_t first = e->first_cluster_low;
+  if (!ctx->ext_cache) {
+    ctx->ext_cache =
+        (struct Fat16ExtCache *)calloc(1, sizeof(struct Fat16ExtCache));
+    if (!ctx->ext_cache)
+      return NULL;
+  }
+  for (int i = 0; i < EXT_CACHE_FILES; i++)
+    if (ctx->ext_cache->files[i].first == first)
+      return &ctx->ext_cache->files[i];
+
+  uint32_t nclusters =
+      (e->file_size + ctx->cluster_size - 1) / ctx->cluster_size;
+  int cap = 8;
+  uint32_t count = 0;
+  FileExtent *ext = (FileExtent *)malloc(sizeof(FileExtent) * (size_t)cap);
+  if (!ext)
+    return NULL;
+
+  uint16_t c = first;
+  for (uint32_t i = 0; i < nclusters; i++) {
+    if (c < 2 || c >= ctx->cluster_limit || c == FAT16_BAD) {
+      printf("Cadeia interrompida.\n");
+      free(ext);
+      return NULL;
+    }
+    if (count > 0 && ext[count - 1].len < 0xFFFF &&
+        c == (uint16_t)(ext[count - 1].start + ext[count - 1].len)) {
+      ext[count - 1].len++;
+    } else {
+      if ((int)count == cap) {
+        cap *= 2;
+        FileExtent *tmp =
+            (FileExtent *)realloc(ext, sizeof(FileExtent) * (size_t)cap);
+        if (!tmp) {
+          free(ext);
+          return NULL;
+        }
+        ext = tmp;
+      }
+      ext[count].file_cluster = i;
+      ext[count].start = c;
+      ext[count].len = 1;
+      count++;
+    }
+    c = fat_next(ctx, c);
+  }
+
+  ExtentList *l = &ctx->ext_cache->files[ctx->ext_cache->next_victim];
+  ctx->ext_cache->next_victim =
+      (ctx->ext_cache->next_victim + 1) % EXT_CACHE_FILES;
+  free(l->ext);
+  l->first = first;
+  l->count = count;
+  l->ext = ext;
+  return l;
+}
+
+/* Extent que contém o cluster lógico fc (busca binária). */
+static const FileExtent *ext_find(const ExtentList *l, uint32_t fc) {
+  uint32_t lo = 0, hi = l->count;
+  while (hi - lo > 1) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (l->ext[mid].file_cluster <= fc)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return &l->ext[lo];
+}
+
+/* ===== Subdiretórios e cache de entradas =====
+ * Subdiretórios são cadeias de clusters com entradas de 32 bytes. Dois
+ * caches evitam reler e revarrer esses clusters em buscas repetidas:
+ *  - clusters de diretório já lidos (LRU com DIR_CACHE_CLUSTERS posições);
+ *  - caminho normalizado (nomes 8.3 concatenados) → cópia da entrada, numa
+ *    tabela de mapeamento direto; buscas profundas partem do maior prefixo
+ *    já conhecido.
+ * Qualquer alteração de metadados descarta os dois (dir_cache_reset).
+ */
+#define DIR_CACHE_CLUSTERS 32
+#define PATH_CACHE_SLOTS 256
+#define PATH_MAX_DEPTH 32
+
+typedef struct {
+  uint16_t cluster; /* 0 → posição vazia */
+  uint32_t last_use;
+  uint8_t *data;
+} DirClusterSlot;
+
+typedef struct {
+  int depth; /* 0 → posição vazia */
+  char key[PATH_MAX_DEPTH * 11];
+  DirectoryEntry ent;
+} PathSlot;
+
+struct Fat16DirCache {
+  DirClusterSlot clusters[DIR_CACHE_CLUSTERS];
+  uint32_t tick;
+  PathSlot paths[PATH_CACHE_SLOTS];
+};
+
+static void dir_cache_reset(Fat16Ctx *ctx) {
+  struct Fat16DirCache *dc = ctx->dir_cache;
+  if (!dc)
+    return;
+  for (int i = 0; i < DIR_CACHE_CLUSTERS; i++)
+    dc->clusters[i].cluster = 0;
+  for (int i = 0; i < PATH_CACHE_SLOTS; i++)
+    dc->paths[i].depth = 0;
+}
+
+static void dir_cache_free(Fat16Ctx *ctx) {
+  if (!ctx->dir_cache)
+    return;
+  for (int i = 0; i < DIR_CACHE_CLUSTERS; i++)
+    free(ctx->dir_cache->clusters[i].data);
+  free(ctx->dir_cache);
+  ctx->dir_cache = NULL;
+}
+
+static struct Fat16DirCache *dir_cache(Fat16Ctx *ctx) {
+  if (!ctx->dir_cache)
+    ctx->dir_cache =
+        (struct Fat16DirCache *)calloc(1, sizeof(struct Fat16DirCache));
+  return ctx->dir_cache;
+}
+
+/* Entradas do cluster de diretório c (válidas até a próxima chamada). */
+static const DirectoryEntry *dir_cluster_get(Fat16Ctx *ctx, uint16_t c) {
+  struct Fat16DirCache *dc = dir_cache(ctx);
+  if (!dc)
+    return NULL;
+  DirClusterSlot *victim = NULL;
+  for (int i = 0; i < DIR_CACHE_CLUSTERS; i++) {
+    DirClusterSlot *sl = &dc->clusters[i];
+    if (sl->cluster != 0 && sl->cluster == c) {
+      sl->last_use = ++dc->tick;
+      return (const DirectoryEntry *)sl->data;
+    }
+    /* posição vazia primeiro; senão a usada há mais tempo */
+    if (!victim || (victim->cluster != 0 &&
+                    (sl->cluster == 0 || sl->last_use < victim->last_use)))
+      victim = sl;
+  }
+  if (!victim->data) {
+    victim->data = (uint8_t *)malloc(ctx->cluster_size);
+    if (!victim->data)
+      return NULL;
+  }
+  if (!img_read(ctx, cluster_offset(ctx, c), victim->data,
+                ctx->cluster_size)) {
+    victim->cluster = 0;
+    return NULL;
+  }
+  victim->cluster = c;
+  victim->last_use = ++dc->tick;
+  return (const DirectoryEntry *)victim->data;
+}
+
+/*
+ * Percorre as entradas com nome do subdiretório iniciado em first, chamando
+ * fn(arg, e) até ela retornar diferente de 0 (valor devolvido) ou a lista
+ * acabar (marcador 0x00 ou fim da cadeia → 0).
+ */
+typedef int (*DirEntFn)(void *arg, const DirectoryEntry *e);
+
+static int subdir_walk(Fat16Ctx *ctx, uint16_t first, DirEntFn fn, void *arg) {
+  uint32_t per = ctx->cluster_size / sizeof(DirectoryEntry), steps = 0;
+  uint16_t c = first;
+  while (c >= 2 && c < ctx->cluster_limit) {
+    const DirectoryEntry *ents = dir_cluster_get(ctx, c);
+    if (!ents)
+      return 0;
+    for (uint32_t i = 0; i < per; i++) {
+      tl_dirents++;
+      if (ents[i].filename[0] == 0x00)
+        return 0;
+      if (!entry_named(&ents[i]))
+        continue;
+      int r = fn(arg, &ents[i]);
+      if (r)
+        return r;
+    }
+    /* ents pode ser reaproveitado pelo cache na próxima volta */
+    c = fat_next(ctx, c);
+    if (++steps > ctx->cluster_count + 8)
+      return 0;
+  }
+  return 0;
+}
+
+/* Procura o nome 8.3 n83 (11 bytes) no subdiretório iniciado em first,
+ * um cluster por vez com o kernel dir_match. Copia a entrada para out. */
+static int subdir_find(Fat16Ctx *ctx, uint16_t first, const char *n83,
+                       DirectoryEntry *out) {
+  uint32_t per = ctx->cluster_size / sizeof(DirectoryEntry), steps = 0;
+  const ScanKernels *k = scan_kernels();
+  uint16_t c = first;
+  while (c >= 2 && c < ctx->cluster_limit) {
+    const DirectoryEntry *ents = dir_cluster_get(ctx, c);
+    if (!ents)
+      return 0;
+    for (uint32_t i = 0; i < per; i++) {
+      i += k->dir_match(ents + i, per - i, n83);
+      if (i == per)
+        break;
+      if (ents[i].filename[0] == 0x00) {
+        tl_dirents += i + 1;
+        return 0;
+      }
+      if (entry_named(&ents[i])) {
+        tl_dirents += i + 1;
+        *out = ents[i];
+        return 1;
+      }
+    }
+    tl_dirents += per;
+    c = fat_next(ctx, c);
+    if (++steps > ctx->cluster_count + 8)
+      return 0;
+  }
+  return 0;
+}
+
+static uint32_t path_hash(const char *key, int depth) {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < depth * 11; i++) {
+    h ^= (uint8_t)key[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static PathSlot *path_slot(struct Fat16DirCache *dc, const char *key,
+                           int depth) {
+  return &dc->paths[path_hash(key, depth) % PATH_CACHE_SLOTS];
+}
+
+/* Divide path em nomes 8.3 (11 bytes cada) em key; trata "." e "..". */
+static int path_split(const char *path, char *key) {
+  int depth = 0;
+  const char *p = path;
+  while (*p) {
+    while (*p == '/')
+      p++;
+    if (!*p)
+      break;
+    const char *end = strchr(p, '/');
+    size_t len = end ? (size_t)(end - p) : strlen(p);
+    char comp[64];
+    if (len >= sizeof(comp))
+      return -1;
+    memcpy(comp, p, len);
+    comp[len] = '\0';
+    p += len;
+
+    if (strcmp(comp, ".") == 0)
+      continue;
+    if (strcmp(comp, "..") == 0) {
+      if (depth > 0)
+        depth--;
+      continue;
+    }
+    if (depth == PATH_MAX_DEPTH)
+      return -1;
+    fat16_to83(comp, key + depth * 11, key + depth * 11 + 8);
+    depth++;
+  }
+  return depth;
+}
+
+/*
+ * Resolve um caminho a partir da raiz e copia a entrada para out.
+ * Retorna 1 se achou, 2 se o caminho é a própria raiz, 0 se não existe.
+ * Exige dcache_lock: o cache de diretórios é compartilhado entre leitores.
+ */
+static int resolve_walk(Fat16Ctx *ctx, const char *path, DirectoryEntry *out) {
+  char key[PATH_MAX_DEPTH * 11];
+  int depth = path_split(path, key);
+  if (depth < 0)
+    return 0;
+  if (depth == 0)
+    return 2;
+  struct Fat16DirCache *dc = dir_cache(ctx);
+  if (!dc)
+    return 0;
+
+  /* maior prefixo já resolvido */
+  int k = depth;
+  for (; k > 0; k--) {
+    PathSlot *ps = path_slot(dc, key, k);
+    if (ps->depth == k && memcmp(ps->key, key, (size_t)k * 11) == 0) {
+      *out = ps->ent;
+      break;
+    }
+  }
+
+  for (; k < depth; k++) {
+    const char *n83 = key + k * 11;
+    if (k == 0) {
+      DirectoryEntry *e = find_in_root(ctx, n83, FIND_ANY);
+      if (!e)
+        return 0;
+      *out = *e;
+    } else {
+      if (!(out->attributes & ATTR_DIRECTORY))
+        return 0;
+      DirectoryEntry parent = *out;
+      if (!subdir_find(ctx, parent.first_cluster_low, n83, out))
+        return 0;
+    }
+    PathSlot *ps = path_slot(dc, key, k + 1);
+    ps->depth = k + 1;
+    memcpy(ps->key, key, (size_t)(k + 1) * 11);
+    ps->ent = *out;
+  }
+  return 1;
+}
+
+static int resolve_path(Fat16Ctx *ctx, const char *path, DirectoryEntry *out) {
+  pthread_mutex_lock(&ctx->dcache_lock);
+  int r = resolve_walk(ctx, path, out);
+  pthread_mutex_unlock(&ctx->dcache_lock);
+  return r;
+}
+
+/* Arquivo regular por nome 8.3 na raiz ou por caminho com '/'; entradas de
+ * subdiretório são copiadas em tmp. */
+static const DirectoryEntry *find_file(Fat16Ctx *ctx, const char *name,
+                                       DirectoryEntry *tmp) {
+  if (!strchr(name, '/'))
+    return find_by_name(ctx, name);
+  if (resolve_path(ctx, name, tmp) != 1 || !entry_regular(tmp))
+    return NULL;
+  return tmp;
+}
+
+/* ================= Implementação da API pública ================= */
+
+int fat16_open(Fat16Ctx *ctx, const char *img_path) {
+  return fat16_open_ex(ctx, img_path, NULL);
+}
+
+int fat16_open_ex(Fat16Ctx *ctx, const char *img_path,
+                  const Fat16Options *opt) {
+  unsigned flags = opt ? opt->flags : 0;
+  memset(ctx, 0, sizeof(*ctx));
+  pthread_rwlock_init(&ctx->lock, NULL);
+  pthread_mutex_init(&ctx->cache_lock, NULL);
+  pthread_mutex_init(&ctx->dcache_lock, NULL);
+  pthread_mutex_init(&ctx->page_lock, NULL);
+  ctx->locks_ready = 1;
+  int overlay = (flags & FAT16_OPEN_OVERLAY) != 0;
+  int quiet = (flags & FAT16_OPEN_QUIET) != 0;
+  ctx->lazy = (flags & FAT16_OPEN_LAZY) != 0;
+  ctx->img = fopen(img_path, overlay ? "rb" : "r+b");
+  if (!ctx->img) {
+    printf("Não consegui abrir '%s'.\n", img_path);
+    return 0;
+  }
+  /* overlay: a base não é alterada; antes de qualquer leitura, pois o
+   * delta pode ter blocos mais novos que a base */
+  if (overlay && !ovl_open(ctx, img_path, opt->overlay_path)) {
+    printf("Não consegui abrir o delta do overlay.\n");
+    fat16_close(ctx);
+    return 0;
+  }
+  if (overlay) {
+    /* backends que gravariam direto na base */
+    unsigned direct = FAT16_OPEN_MMAP | FAT16_OPEN_URING | FAT16_OPEN_SPARSE |
+                      FAT16_OPEN_JOURNAL;
+    if (flags & direct)
+      printf("Overlay: mmap, io_uring, esparso e journal ignorados.\n");
+    flags &= ~direct;
+    flags |= FAT16_OPEN_NO_KCOPY;
+  }
+  if (!load_boot(ctx) || ctx->bpb.bytes_per_sector == 0) {
+    printf("Boot inválido.\n");
+    fat16_close(ctx);
+    return 0;
+  }
+  if ((flags & FAT16_OPEN_MMAP) && !map_image(ctx))
+    printf("mmap indisponível; usando stdio.\n");
+  if (opt && opt->cache_blocks > 0) {
+    if (ctx->map)
+      printf("Cache de blocos ignorado no modo mmap.\n");
+    else if (!bc_init(ctx, opt->cache_blocks, opt->cache_policy))
+      printf("Sem memória para o cache; seguindo sem cache.\n");
+  }
+  ctx->sparse = (flags & FAT16_OPEN_SPARSE) != 0;
+  /* cópia no kernel só quando a imagem é lida/gravada direto (pread/pwrite):
+   * com mmap ou cache os dados passariam por fora deles, e o modo esparso
+   * precisa ver os dados para achar os clusters zerados */
+  if (!ctx->map && !ctx->bcache && !ctx->sparse &&
+      !(flags & FAT16_OPEN_NO_KCOPY))
+    ctx->kcopy = 2;
+  if (flags & FAT16_OPEN_URING) {
+    if (ctx->map || ctx->bcache)
+      printf("io_uring ignorado com mmap ou cache de blocos.\n");
+    else if (!uring_init(ctx, (opt && opt->uring_depth) ? opt->uring_depth
+                                                        : 64))
+      printf("io_uring indisponível; usando E/S síncrona.\n");
+  }
+  /* transações de uma sessão interrompida, antes de carregar FAT e raiz */
+  char jpath[512];
+  snprintf(jpath, sizeof(jpath), "%s.jnl", img_path);
+  if (ctx->overlay && access(jpath, F_OK) == 0) {
+    printf("'%s' tem journal pendente; abra uma vez sem overlay.\n",
+           img_path);
+    fat16_close(ctx);
+    return 0;
+  }
+  if (!jnl_replay(ctx, jpath)) {
+    printf("Erro ao reaplicar o journal '%s'.\n", jpath);
+    fat16_close(ctx);
+    return 0;
+  }
+  if (!load_fat(ctx)) {
+    printf("FAT inválida.\n");
+    fat16_close(ctx);
+    return 0;
+  }
+  if (!load_root(ctx)) {
+    printf("Root inválido.\n");
+    fat16_close(ctx);
+    return 0;
+  }
+  compute_derived(ctx);
+  if (!alloc_free_index(ctx) || !alloc_name_index(ctx)) {
+    printf("Erro de memória.\n");
+    fat16_close(ctx);
+    return 0;
+  }
+  if (!ctx->lazy) {
+    need_free_index(ctx);
+    need_name_index(ctx);
+  }
+  if (!quiet) {
+    printf("Bytes/Setor=%u  Setores/Cluster=%u  #FATs=%u  RootEntries=%u\n",
+           ctx->bpb.bytes_per_sector, ctx->bpb.sectors_per_cluster,
+           ctx->bpb.num_fats, ctx->bpb.root_entry_count);
+    if (ctx->free_ready)
+      printf("FAT(setores)=%u  FirstDataSector=%u  ClustersDados=%u  "
+             "Livres=%u\n",
+             ctx->bpb.fat_size_16, ctx->first_data_sector, ctx->cluster_count,
+             ctx->free_count);
+    else
+      printf("FAT(setores)=%u  FirstDataSector=%u  ClustersDados=%u  "
+             "(lazy: FAT e raiz lidas sob demanda)\n",
+             ctx->bpb.fat_size_16, ctx->first_data_sector, ctx->cluster_count);
+  }
+  if (ctx->map && !quiet)
+    printf("Backend: mmap (%lu bytes mapeados)\n", (unsigned long)ctx->map_len);
+  if (ctx->bcache && !quiet)
+    printf("Cache: %u blocos de %u bytes (%s)\n", ctx->bcache->nblocks,
+           ctx->bcache->bsize,
+           ctx->bcache->policy == FAT16_CACHE_CLOCK ? "CLOCK" : "LRU");
+  if (ctx->uring && !quiet)
+    printf("Backend: io_uring (fila de %u pedidos)\n", ctx->uring->depth);
+  if (ctx->overlay && !quiet) {
+    if (ctx->overlay->fd >= 0)
+      printf("Overlay: base somente leitura, delta '%s' (%u bloco(s))\n",
+             opt->overlay_path, ctx->overlay->used);
+    else
+      printf("Overlay: base somente leitura, delta em memória\n");
+  }
+  if (flags & FAT16_OPEN_JOURNAL) {
+    if (ctx->map)
+      printf("Journal ignorado no modo mmap.\n");
+    else if (!jnl_open(ctx, img_path, opt->journal_ops))
+      printf("Não consegui criar o journal; gravando metadados na hora.\n");
+    else if (!quiet)
+      printf("Journal: '%s' (commit a cada %u operação(ões))\n",
+             ctx->journal->path, ctx->journal->every);
+  }
+  if (ctx->sparse && !quiet) {
+    struct stat st;
+    if (fstat(fileno(ctx->img), &st) == 0)
+      printf("Modo esparso: %lu KiB ocupados no host (arquivo de %lu KiB)\n",
+             (unsigned long)st.st_blocks / 2,
+             (unsigned long)st.st_size / 1024);
+  }
+  return 1;
+}
+
+int fat16_flush(Fat16Ctx *ctx) {
+  int ok = 1;
+  uint64_t t0 = op_begin();
+  ctx_wrlock(ctx);
+  if (ctx->journal)
+    ok &= jnl_commit(ctx);
+  ok &= save_fat(ctx);
+  ok &= save_root(ctx);
+  pthread_mutex_lock(&ctx->cache_lock);
+  ok &= bc_flush(ctx);
+  pthread_mutex_unlock(&ctx->cache_lock);
+  img_sync(ctx);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_FLUSH, t0);
+  return ok;
+}
+
+/* Grava os blocos do delta na base, reaberta para escrita só aqui. */
+static int ovl_commit(Fat16Ctx *ctx) {
+  struct Fat16Overlay *o = ctx->overlay;
+  int fd = open(o->path, O_WRONLY);
+  if (fd < 0) {
+    printf("Não consegui abrir '%s' para escrita.\n", o->path);
+    return 0;
+  }
+  uint8_t tmp[OVL_BLOCK];
+  uint32_t n = 0;
+  int ok = 1;
+  for (uint32_t i = 0; i < o->cap && ok; i++) {
+    if (o->keys[i] == 0)
+      continue;
+    long off = (long)(o->keys[i] - 1) * OVL_BLOCK;
+    size_t len = o->size - off < (long)OVL_BLOCK ? (size_t)(o->size - off)
+                                                 : OVL_BLOCK;
+    const uint8_t *p = o->data ? o->data[i] : tmp;
+    if (!o->data)
+      ok = pread(o->fd, tmp, len, (off_t)(o->rec[i] + 8)) == (ssize_t)len;
+    ok = ok && pwrite(fd, p, len, (off_t)off) == (ssize_t)len;
+    n++;
+  }
+  ok = ok && fdatasync(fd) == 0;
+  close(fd);
+  if (!ok) {
+    printf("Erro ao aplicar o delta em '%s'.\n", o->path);
+    return 0;
+  }
+  /* a base agora tem tudo: o delta recomeça vazio */
+  ovl_clear(o);
+  o->base_size = o->size;
+  if (o->fd >= 0 && (ftruncate(o->fd, o->end) != 0 || !ovl_sync(ctx)))
+    printf("Erro ao esvaziar o delta.\n");
+  printf("Overlay: %u bloco(s) aplicados em '%s'.\n", n, o->path);
+  return 1;
+}
+
+int fat16_overlay_commit(Fat16Ctx *ctx) {
+  if (!ctx->overlay)
+    return 0;
+  uint64_t t0 = op_begin();
+  ctx_wrlock(ctx);
+  /* FAT e raiz já foram salvas pelas operações; faltam os blocos sujos do
+   * cache, que ainda não chegaram ao delta */
+  pthread_mutex_lock(&ctx->cache_lock);
+  int ok = bc_flush(ctx);
+  pthread_mutex_unlock(&ctx->cache_lock);
+  ok = ok && ovl_commit(ctx);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_OVERLAY_COMMIT, t0);
+  return ok;
+}
+
+void fat16_close(Fat16Ctx *ctx) {
+  if (ctx->journal) {
+    if (!jnl_commit(ctx))
+      printf("Erro ao gravar o journal.\n");
+    jnl_close(ctx);
+  }
+  if (ctx->bcache) {
+    if (!bc_flush(ctx))
+      printf("Erro ao gravar o cache.\n");
+    bc_free(ctx);
+  }
+  if (ctx->map) {
+    /* fat e root apontam para dentro do mapa */
+    img_sync(ctx);
+    munmap(ctx->map, ctx->map_len);
+    ctx->map = NULL;
+    ctx->fat = NULL;
+    ctx->root = NULL;
+  }
+  if (ctx->root) {
+    free(ctx->root);
+    ctx->root = NULL;
+  }
+  if (ctx->fat) {
+    free(ctx->fat);
+    ctx->fat = NULL;
+  }
+  free(ctx->free_map);
+  free(ctx->free_sum);
+  free(ctx->name_head);
+  free(ctx->name_next);
+  free(ctx->slot_free);
+  free(ctx->fat_dirty);
+  free(ctx->fat_loaded);
+  free(ctx->root_dirty);
+  ext_cache_free(ctx);
+  dir_cache_free(ctx);
+  uring_free(ctx);
+  ovl_free(ctx);
+  if (ctx->img) {
+    fclose(ctx->img);
+    ctx->img = NULL;
+  }
+  if (ctx->locks_ready) {
+    pthread_rwlock_destroy(&ctx->lock);
+    pthread_mutex_destroy(&ctx->cache_lock);
+    pthread_mutex_destroy(&ctx->dcache_lock);
+    pthread_mutex_destroy(&ctx->page_lock);
+  }
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+int fat16_file_spans(Fat16Ctx *ctx, const char *name83, Fat16Span *spans,
+                     int max) {
+  if (!ctx->map)
+    return -1;
+  uint64_t t0 = op_begin();
+  ctx_rdlock(ctx);
+  SpanRun sr = {spans, max, 0};
+  DirectoryEntry *e = find_by_name(ctx, name83);
+  int ok = e && walk_runs(ctx, e, span_run, &sr);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_FILE_SPANS, t0);
+  return ok ? sr.n : -1;
+}
+
+long fat16_pread(Fat16Ctx *ctx, const DirectoryEntry *e, uint32_t offset,
+                 size_t len, void *buf) {
+  if (offset >= e->file_size)
+    return 0;
+  if (len > e->file_size - offset)
+    len = e->file_size - offset;
+
+  uint64_t t0 = op_begin();
+  ctx_rdlock(ctx);
+  IoReq q[IO_BATCH];
+  int nq = 0;
+  size_t done = 0;
+  while (done < len) {
+    uint32_t pos = offset + (uint32_t)done;
+    uint32_t fc = pos / ctx->cluster_size;
+    /* o cache é compartilhado: copia o extent e solta a trava antes da E/S */
+    pthread_mutex_lock(&ctx->dcache_lock);
+    ExtentList *l = ext_cache_get(ctx, e);
+    FileExtent x = {0, 0, 0};
+    if (l)
+      x = *ext_find(l, fc);
+    pthread_mutex_unlock(&ctx->dcache_lock);
+    if (!l) {
+      ctx_unlock(ctx);
+      op_end(ctx, FAT16_OP_PREAD, t0);
+      return -1;
+    }
+    /* do ponto atual até o fim do extent, numa leitura só */
+    uint32_t skip = pos - x.file_cluster * ctx->cluster_size;
+    size_t n = (size_t)x.len * ctx->cluster_size - skip;
+    if (n > len - done)
+      n = len - done;
+    if (nq == IO_BATCH) {
+      if (!io_batch(ctx, 0, q, nq))
+        break;
+      nq = 0;
+    }
+    q[nq].off = cluster_offset(ctx, x.start) + (long)skip;
+    q[nq].buf = (uint8_t *)buf + done;
+    q[nq].len = n;
+    nq++;
+    done += n;
+  }
+  int ok = done == len && io_batch(ctx, 0, q, nq);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_PREAD, t0);
+  if (!ok) {
+    printf("Falha leitura.\n");
+    return -1;
+  }
+  return (long)done;
+}
+
+const DirectoryEntry *fat16_lookup(Fat16Ctx *ctx, const char *name83) {
+  uint64_t t0 = op_begin();
+  ctx_rdlock(ctx);
+  const DirectoryEntry *e = find_by_name(ctx, name83);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_LOOKUP, t0);
+  return e;
+}
+
+int fat16_lookup_path(Fat16Ctx *ctx, const char *path, DirectoryEntry *out) {
+  uint64_t t0 = op_begin();
+  ctx_rdlock(ctx);
+  int r = resolve_path(ctx, path, out);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_LOOKUP_PATH, t0);
+  return r == 1;
+}
+
+int fat16_reader_open(Fat16Ctx *ctx, const DirectoryEntry *e, Fat16Reader *r) {
+  memset(r, 0, sizeof(*r));
+  r->ctx = ctx;
+  r->size = e->file_size;
+  r->cur = e->first_cluster_low;
+  return 1;
+}
+
+/* Valida o cluster c da cadeia do leitor; em erro marca r->error. */
+static int reader_check(Fat16Reader *r, uint16_t c) {
+  Fat16Ctx *ctx = r->ctx;
+  if (c == FAT16_FREE)
+    printf("Cadeia interrompida.\n");
+  else if (c == FAT16_BAD)
+    printf("Cluster BAD.\n");
+  else if (c < 2 || c >= ctx->cluster_limit)
+    printf("Cluster fora do limite.\n");
+  else if (++r->steps > ctx->cluster_count + 8)
+    printf("Loop suspeito.\n");
+  else
+    return 1;
+  r->error = 1;
+  return 0;
+}
+
+static long reader_read(Fat16Reader *r, void *buf, size_t len) {
+  Fat16Ctx *ctx = r->ctx;
+  if (r->error)
+    return -1;
+  uint32_t want = r->size - r->pos;
+  if (len < want)
+    want = (uint32_t)len;
+
+  /* as corridas são enfileiradas e lidas em lote (io_batch) */
+  IoReq q[IO_BATCH];
+  int nq = 0;
+  uint32_t done = 0;
+  while (done < want) {
+    if (r->off_in == ctx->cluster_size) {
+      r->cur = fat_next(ctx, r->cur);
+      r->off_in = 0;
+    }
+    if (r->off_in == 0 && !reader_check(r, r->cur))
+      return -1;
+
+    /* estende a corrida enquanto a cadeia for contígua e ainda faltar
+     * espaço em buf: uma leitura só por corrida */
+    uint16_t start = r->cur;
+    uint32_t span = ctx->cluster_size - r->off_in;
+    while (done + span < want) {
+      uint16_t next = fat_next(ctx, r->cur);
+      if (next != (uint16_t)(r->cur + 1))
+        break;
+      if (!reader_check(r, next))
+        return -1;
+      r->cur = next;
+      span += ctx->cluster_size;
+    }
+
+    uint32_t n = (want - done < span) ? want - done : span;
+    if (nq == IO_BATCH) {
+      if (!io_batch(ctx, 0, q, nq))
+        break;
+      nq = 0;
+    }
+    q[nq].off = cluster_offset(ctx, start) + (long)r->off_in;
+    q[nq].buf = (uint8_t *)buf + done;
+    q[nq].len = n;
+    nq++;
+    done += n;
+    r->pos += n;
+    r->off_in = ctx->cluster_size - (span - n);
+  }
+  if (done < want || !io_batch(ctx, 0, q, nq)) {
+    printf("Falha leitura.\n");
+    r->error = 1;
+    return -1;
+  }
+  return (long)done;
+}
+
+long fat16_reader_read(Fat16Reader *r, void *buf, size_t len) {
+  uint64_t t0 = op_begin();
+  ctx_rdlock(r->ctx);
+  long n = reader_read(r, buf, len);
+  ctx_unlock(r->ctx);
+  op_end(r->ctx, FAT16_OP_READ, t0);
+  return n;
+}
+
+void fat16_reader_close(Fat16Reader *r) { memset(r, 0, sizeof(*r)); }
+
+void fat16_cache_stats(Fat16Ctx *ctx, Fat16CacheStats *st) {
+  memset(st, 0, sizeof(*st));
+  pthread_mutex_lock(&ctx->cache_lock);
+  st->hits = ctx->cache_hits;
+  st->misses = ctx->cache_misses;
+  st->writebacks = ctx->cache_writebacks;
+  if (ctx->bcache) {
+    st->blocks = ctx->bcache->nblocks;
+    st->block_size = ctx->bcache->bsize;
+    for (uint32_t i = 0; i < ctx->bcache->nblocks; i++)
+      st->dirty += ctx->bcache->dirty[i];
+  }
+  pthread_mutex_unlock(&ctx->cache_lock);
+}
+
+uint32_t fat16_free_clusters(Fat16Ctx *ctx) {
+  need_free_index(ctx);
+  return ctx->free_count;
+}
+
+static const char *const op_names[FAT16_OP_COUNT] = {
+    "list_dir",    "list_path",   "show_file", "show_attrs",
+    "rename",      "delete",      "create",    "import",
+    "lookup",      "lookup_path", "read",      "pread",
+    "file_spans",  "flush",       "check",     "defrag",
+    "extract",     "write_at",    "append",    "truncate",
+    "overlay_commit", "readdir"};
+
+const char *fat16_op_name(int op) {
+  return (op >= 0 && op < FAT16_OP_COUNT) ? op_names[op] : "?";
+}
+
+/* Fat16Stats só tem campos uint64_t: copiados um a um, atomicamente. */
+void fat16_stats(Fat16Ctx *ctx, Fat16Stats *st) {
+  const uint64_t *src = (const uint64_t *)&ctx->stats;
+  uint64_t *dst = (uint64_t *)st;
+  for (size_t i = 0; i < sizeof(Fat16Stats) / sizeof(uint64_t); i++)
+    dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+void fat16_stats_reset(Fat16Ctx *ctx) {
+  uint64_t *p = (uint64_t *)&ctx->stats;
+  for (size_t i = 0; i < sizeof(Fat16Stats) / sizeof(uint64_t); i++)
+    __atomic_store_n(&p[i], 0, __ATOMIC_RELAXED);
+}
+
+/* Limite superior (µs) do balde onde cai a fração q das chamadas. */
+static uint64_t hist_quantile(const Fat16OpStats *s, double q) {
+  uint64_t want = (uint64_t)((double)s->calls * q), acc = 0;
+  if (want == 0)
+    want = 1;
+  for (int b = 0; b < FAT16_LAT_BUCKETS; b++) {
+    acc += s->hist[b];
+    if (acc >= want)
+      return 1ull << b;
+  }
+  return 1ull << (FAT16_LAT_BUCKETS - 1);
+}
+
+void fat16_show_stats(Fat16Ctx *ctx) {
+  Fat16Stats st;
+  fat16_stats(ctx, &st);
+  printf("E/S na imagem: %llu leitura(s) (%llu bytes), %llu escrita(s) "
+         "(%llu bytes), %llu seek(s)\n",
+         (unsigned long long)st.reads, (unsigned long long)st.bytes_read,
+         (unsigned long long)st.writes, (unsigned long long)st.bytes_written,
+         (unsigned long long)st.seeks);
+  printf("Entradas da FAT percorridas: %llu  Entradas de diretório "
+         "examinadas: %llu\n",
+         (unsigned long long)st.fat_walked,
+         (unsigned long long)st.dirents_scanned);
+  /* percentis: limite superior do balde do histograma */
+  printf("Operação      Chamadas   Média(µs)  p50<(µs)  p99<(µs)     "
+         "Máx(µs)\n");
+  int any = 0;
+  for (int op = 0; op < FAT16_OP_COUNT; op++) {
+    const Fat16OpStats *s = &st.ops[op];
+    if (s->calls == 0)
+      continue;
+    any = 1;
+    printf("%-12s %9llu %11.1f %9llu %9llu %11.1f\n", op_names[op],
+           (unsigned long long)s->calls,
+           (double)s->total_ns / 1000.0 / (double)s->calls,
+           (unsigned long long)hist_quantile(s, 0.50),
+           (unsigned long long)hist_quantile(s, 0.99),
+           (double)s->max_ns / 1000.0);
+  }
+  if (!any)
+    printf("(nenhuma operação registrada)\n");
+}
+
+int fat16_stats_json(Fat16Ctx *ctx, FILE *out) {
+  Fat16Stats st;
+  Fat16CacheStats cs;
+  fat16_stats(ctx, &st);
+  fat16_cache_stats(ctx, &cs);
+  fprintf(out,
+          "{\n  \"io\": {\"seeks\": %llu, \"reads\": %llu, \"writes\": %llu, "
+          "\"bytes_read\": %llu, \"bytes_written\": %llu},\n",
+          (unsigned long long)st.seeks, (unsigned long long)st.reads,
+          (unsigned long long)st.writes, (unsigned long long)st.bytes_read,
+          (unsigned long long)st.bytes_written);
+  fprintf(out, "  \"fat_walked\": %llu,\n  \"dirents_scanned\": %llu,\n",
+          (unsigned long long)st.fat_walked,
+          (unsigned long long)st.dirents_scanned);
+  fprintf(out,
+          "  \"cache\": {\"blocks\": %u, \"hits\": %llu, \"misses\": %llu, "
+          "\"writebacks\": %llu},\n",
+          cs.blocks, (unsigned long long)cs.hits,
+          (unsigned long long)cs.misses, (unsigned long long)cs.writebacks);
+  /* hist_us[i]: chamadas com latência < 2^i µs (e >= 2^(i-1)) */
+  fprintf(out, "  \"ops\": {");
+  for (int op = 0; op < FAT16_OP_COUNT; op++) {
+    const Fat16OpStats *s = &st.ops[op];
+    fprintf(out,
+            "%s\n    \"%s\": {\"calls\": %llu, \"total_ns\": %llu, "
+            "\"max_ns\": %llu, \"hist_us\": [",
+            op ? "," : "", op_names[op], (unsigned long long)s->calls,
+            (unsigned long long)s->total_ns, (unsigned long long)s->max_ns);
+    for (int b = 0; b < FAT16_LAT_BUCKETS; b++)
+      fprintf(out, "%s%llu", b ? ", " : "", (unsigned long long)s->hist[b]);
+    fprintf(out, "]}");
+  }
+  fprintf(out, "\n  }\n}\n");
+  return fflush(out) == 0 && !ferror(out);
+}
+
+typedef struct {
+  int files;
+  int dirs;
+} ListCount;
+
+static int list_entry(void *arg, const DirectoryEntry *e) {
+  ListCount *lc = (ListCount *)arg;
+  char nm[13];
+  make_readable(e, nm);
+  if (e->attributes & ATTR_DIRECTORY) {
+    printf("%-13s %12s\n", nm, "<DIR>");
+    lc->dirs++;
+  } else {
+    printf("%-13s %12lu\n", nm, (unsigned long)e->file_size);
+    lc->files++;
+  }
+  return 0;
+}
+
+static void list_root(Fat16Ctx *ctx) {
+  (void)ctx;
+  printf("\n========== DIRETÓRIO RAIZ ==========\n");
+  printf("%-13s %12s\n", "Arquivo", "Tamanho");
+  printf("------------------------------------\n");
+
+  ListCount lc = {0, 0};
+  for (int i = 0; i < ctx->bpb.root_entry_count; i++) {
+    DirectoryEntry *e = &ctx->root[i];
+    if (entry_named(e))
+      list_entry(&lc, e);
+  }
+  tl_dirents += ctx->bpb.root_entry_count;
+  if (lc.files + lc.dirs == 0)
+    printf("(sem arquivos)\n");
+  need_free_index(ctx);
+  printf("------------------------------------\n");
+  printf("Total: %d arquivo(s), %d pasta(s)  Clusters livres: %u\n", lc.files,
+         lc.dirs, ctx->free_count);
+}
+
+static void list_path(Fat16Ctx *ctx, const char *path) {
+  DirectoryEntry d;
+  int r = resolve_path(ctx, path, &d);
+  if (r == 2) {
+    list_root(ctx);
+    return;
+  }
+  if (r == 0 || !(d.attributes & ATTR_DIRECTORY)) {
+    printf("Diretório '%s' não encontrado.\n", path);
+    return;
+  }
+  printf("\n========== %s ==========\n", path);
+  printf("%-13s %12s\n", "Arquivo", "Tamanho");
+  printf("------------------------------------\n");
+  ListCount lc = {0, 0};
+  pthread_mutex_lock(&ctx->dcache_lock);
+  subdir_walk(ctx, d.first_cluster_low, list_entry, &lc);
+  pthread_mutex_unlock(&ctx->dcache_lock);
+  if (lc.files + lc.dirs == 0)
+    printf("(vazio)\n");
+  printf("------------------------------------\n");
+  printf("Total: %d arquivo(s), %d pasta(s)\n", lc.files, lc.dirs);
+}
+
+static void show_file(Fat16Ctx *ctx, const char *name83) {
+  DirectoryEntry tmp;
+  const DirectoryEntry *e = find_file(ctx, name83, &tmp);
+  if (!e) {
+    printf("Arquivo '%s' não encontrado.\n", name83);
+    return;
+  }
+  if (ctx->map) {
+    /* zero-copy: imprime direto dos trechos mapeados */
+    printf("\n--- Conteúdo de '%s' (%lu bytes) ---\n", name83,
+           (unsigned long)e->file_size);
+    walk_runs(ctx, e, print_run, NULL);
+    putchar('\n');
+    return;
+  }
+
+  Fat16Reader r;
+  if (!fat16_reader_open(ctx, e, &r))
+    return;
+  size_t cap = (ctx->cluster_size > 65536) ? ctx->cluster_size : 65536;
+  uint8_t *buf = (uint8_t *)malloc(cap);
+  if (!buf) {
+    printf("Erro de memória.\n");
+    fat16_reader_close(&r);
+    return;
+  }
+  printf("\n--- Conteúdo de '%s' (%lu bytes) ---\n", name83,
+         (unsigned long)r.size);
+  long got;
+  while ((got = reader_read(&r, buf, cap)) > 0)
+    fwrite(buf, 1, (size_t)got, stdout);
+  putchar('\n');
+  free(buf);
+  fat16_reader_close(&r);
+}
+
+static void show_attrs(Fat16Ctx *ctx, const char *name83) {
+  DirectoryEntry tmp;
+  const DirectoryEntry *e = find_file(ctx, name83, &tmp);
+  if (!e) {
+    printf("Arquivo '%s' não encontrado.\n", name83);
+    return;
+  }
+
+  int d, m, y, hh, mm, ss;
+  printf("\nAtributos de: %s\n", name83);
+  printf("Tamanho: %lu bytes\n", (unsigned long)e->file_size);
+  printf("Extents: %lu\n",
+         (unsigned long)chain_extents(ctx, e->first_cluster_low));
+
+  decode_date(e->creation_date, &d, &m, &y);
+  decode_time(e->creation_time, &hh, &mm, &ss);
+  printf("Criado em:   %02d/%02d/%04d %02d:%02d:%02d\n", d, m, y, hh, mm, ss);
+
+  decode_date(e->last_mod_date, &d, &m, &y);
+  decode_time(e->last_mod_time, &hh, &mm, &ss);
+  printf("Modificado:  %02d/%02d/%04d %02d:%02d:%02d\n", d, m, y, hh, mm, ss);
+
+  printf("Atributos:\n");
+  printf("  RO: %s  Hidden: %s  System: %s  Archive: %s\n",
+         (e->attributes & ATTR_READ_ONLY) ? "Sim" : "Não",
+         (e->attributes & ATTR_HIDDEN) ? "Sim" : "Não",
+         (e->attributes & ATTR_SYSTEM) ? "Sim" : "Não",
+         (e->attributes & ATTR_ARCHIVE) ? "Sim" : "Não");
+}
+
+static int rename_entry(Fat16Ctx *ctx, const char *old83,
+                        const char *new83) {
+  DirectoryEntry *e = find_by_name(ctx, old83);
+  if (!e) {
+    printf("Arquivo '%s' não encontrado.\n", old83);
+    return 0;
+  }
+  if (name_taken(ctx, new83)) {
+    printf("Já existe '%s'.\n", new83);
+    return 0;
+  }
+
+  int idx = (int)(e - ctx->root);
+  char n[8], x[3];
+  fat16_to83(new83, n, x);
+  name_index_del(ctx, idx);
+  memcpy(e->filename, n, 8);
+  memcpy(e->extension, x, 3);
+  name_index_add(ctx, idx);
+  root_touch(ctx, e);
+
+  uint16_t d, t;
+  now_fat(&d, &t);
+  e->last_mod_date = d;
+  e->last_mod_time = t;
+
+  dir_cache_reset(ctx);
+  if (!meta_commit(ctx, 0)) {
+    printf("Erro ao salvar diretório.\n");
+    return 0;
+  }
+  img_sync(ctx);
+  printf("Renomeado: '%s' -> '%s'\n", old83, new83);
+  return 1;
+}
+
+/* Corrida de clusters liberados, para abrir buracos no modo esparso. */
+typedef struct {
+  uint16_t start;
+  uint32_t len;
+} ClusterRun;
+
+/* Acrescenta c às corridas, estendendo a última se for contíguo. */
+static void run_add(ClusterRun **runs, int *n, int *cap, uint16_t c) {
+  if (*n > 0 && (*runs)[*n - 1].start + (*runs)[*n - 1].len == c) {
+    (*runs)[*n - 1].len++;
+    return;
+  }
+  if (*n == *cap) {
+    int ncap = *cap ? *cap * 2 : 16;
+    ClusterRun *p = (ClusterRun *)realloc(*runs, sizeof(ClusterRun) *
+                                                     (size_t)ncap);
+    if (!p)
+      return; /* sem memória: o cluster só não vira buraco */
+    *runs = p;
+    *cap = ncap;
+  }
+  (*runs)[*n].start = c;
+  (*runs)[*n].len = 1;
+  (*n)++;
+}
+
+static int delete_entry(Fat16Ctx *ctx, const char *name83) {
+  DirectoryEntry *e = find_by_name(ctx, name83);
+  if (!e) {
+    printf("Arquivo '%s' não encontrado.\n", name83);
+    return 0;
+  }
+
+  uint16_t c = e->first_cluster_low;
+  uint32_t steps = 0;
+  ClusterRun *runs = NULL;
+  int nruns = 0, cap = 0;
+  ext_cache_invalidate(ctx, c);
+  while (c >= 2 && c < ctx->fat_entries && c < FAT16_EOF_MIN) {
+    uint16_t nx = fat_next(ctx, c);
+    fat_set(ctx, c, FAT16_FREE);
+    if (ctx->sparse)
+      run_add(&runs, &nruns, &cap, c);
+    c = nx;
+    if (++steps > ctx->cluster_count + 8) {
+      printf("Loop suspeito.\n");
+      break;
+    }
+  }
+  int idx = (int)(e - ctx->root);
+  name_index_del(ctx, idx);
+  e->filename[0] = (char)0xE5; /* marca deletado */
+  root_touch(ctx, e);
+  slot_mark(ctx, idx, 1);
+  dir_cache_reset(ctx);
+
+  /* no modo esparso o commit é imediato: o buraco só pode ser aberto
+   * depois que nenhuma FAT em disco aponta para os clusters */
+  if (!meta_commit(ctx, ctx->sparse)) {
+    printf("Erro ao salvar.\n");
+    free(runs);
+    return 0;
+  }
+  img_sync(ctx);
+  /* só depois do commit dos metadados: os dados já não são alcançáveis */
+  for (int i = 0; i < nruns; i++)
+    img_punch(ctx, cluster_offset(ctx, runs[i].start),
+              (size_t)runs[i].len * ctx->cluster_size);
+  free(runs);
+  printf("Removido: '%s'\n", name83);
+  return 1;
+}
+
+/* ===== Verificação de consistência (fsck) =====
+ * Uma passada O(clusters): cada cadeia (arquivos e pastas, da raiz e dos
+ * subdiretórios) é percorrida uma vez marcando um bitmap de dono; achar um
+ * cluster já marcado é ligação cruzada (ou laço) e encerra o percurso, de
+ * modo que nenhum cluster é visitado duas vezes. Depois, clusters em uso
+ * sem dono são perdidos. Os percursos de arquivos e a busca de perdidos
+ * rodam em paralelo (o bitmap é marcado com operações atômicas); as pastas
+ * são lidas antes, em série, porque exigem E/S. Com reparo, os percursos
+ * são feitos em série para que a cadeia que fica com um cluster cruzado seja
+ * sempre a primeira na ordem dos diretórios.
+ */
+
+#define CHK_OK 0
+#define CHK_BROKEN 1 /* cluster livre, BAD ou fora do limite na cadeia */
+#define CHK_CROSS 2  /* chegou a um cluster que já tem dono */
+
+typedef struct {
+  uint16_t first;
+  uint32_t size;
+  uint8_t is_dir;
+  int root_idx; /* >= 0: entrada da raiz; senão ent_off na imagem */
+  long ent_off;
+  int32_t parent; /* pasta que contém a entrada (em chains; -1 → raiz) */
+  char name[13];
+  /* resultado do percurso */
+  uint8_t status;
+  uint32_t len;   /* clusters próprios percorridos */
+  uint16_t last;  /* último cluster próprio (0 se nenhum) */
+  uint16_t cross; /* cluster compartilhado (CHK_CROSS) */
+} CheckChain;
+
+typedef struct {
+  Fat16Ctx *ctx;
+  uint64_t *owned;
+  CheckChain *chains;
+  uint32_t nchains, cap;
+  uint32_t next; /* próximo trabalho (atômico) */
+  uint32_t lost; /* atômico */
+} CheckJob;
+
+static void check_walk(Fat16Ctx *ctx, uint64_t *owned, CheckChain *ch) {
+  uint16_t c = ch->first;
+  ch->status = CHK_OK;
+  ch->len = 0;
+  ch->last = 0;
+  if (c == 0)
+    return;
+  for (;;) {
+    if (c < 2 || c >= ctx->cluster_limit) {
+      ch->status = CHK_BROKEN;
+      return;
+    }
+    uint64_t bit = 1ull << (c & 63);
+    if (__atomic_fetch_or(&owned[c >> 6], bit, __ATOMIC_RELAXED) & bit) {
+      ch->status = CHK_CROSS;
+      ch->cross = c;
+      return;
+    }
+    ch->len++;
+    ch->last = c;
+    uint16_t v = fat_next(ctx, c);
+    if (v >= FAT16_EOF_MIN)
+      return;
+    if (v == FAT16_FREE || v == FAT16_BAD) {
+      ch->status = CHK_BROKEN;
+      return;
+    }
+    c = v;
+  }
+}
+
+static int check_add(CheckJob *job, const DirectoryEntry *e, int root_idx,
+                     long ent_off, int32_t parent) {
+  if (job->nchains == job->cap) {
+    uint32_t cap = job->cap ? job->cap * 2 : 256;
+    CheckChain *p = (CheckChain *)realloc(job->chains,
+                                          sizeof(CheckChain) * cap);
+    if (!p)
+      return 0;
+    job->chains = p;
+    job->cap = cap;
+  }
+  CheckChain *ch = &job->chains[job->nchains++];
+  memset(ch, 0, sizeof(*ch));
+  ch->first = e->first_cluster_low;
+  ch->size = e->file_size;
+  ch->is_dir = (e->attributes & ATTR_DIRECTORY) != 0;
+  ch->root_idx = root_idx;
+  ch->ent_off = ent_off;
+  ch->parent = parent;
+  make_readable(e, ch->name);
+  return 1;
+}
+
+/* Fase serial: registra as entradas da raiz e desce pelos subdiretórios
+ * (em largura), percorrendo a cadeia de cada pasta para ler seu conteúdo.
+ * Pasta cuja cadeia já tinha dono não é lida de novo (evita ciclos). */
+static int check_collect(CheckJob *job) {
+  Fat16Ctx *ctx = job->ctx;
+  for (int i = 0; i < ctx->bpb.root_entry_count; i++) {
+    const DirectoryEntry *e = &ctx->root[i];
+    tl_dirents++;
+    if (e->filename[0] == 0x00)
+      break;
+    if (entry_named(e) && !check_add(job, e, i, 0, -1))
+      return 0;
+  }
+  uint8_t *buf = (uint8_t *)malloc(ctx->cluster_size);
+  if (!buf)
+    return 0;
+  uint32_t per = ctx->cluster_size / sizeof(DirectoryEntry);
+  for (uint32_t k = 0; k < job->nchains; k++) {
+    if (!job->chains[k].is_dir)
+      continue;
+    check_walk(ctx, job->owned, &job->chains[k]);
+    uint16_t c = job->chains[k].first;
+    uint32_t len = job->chains[k].len;
+    int end = 0;
+    for (uint32_t n = 0; n < len && !end; n++, c = fat_next(ctx, c)) {
+      long base = cluster_offset(ctx, c);
+      if (!img_read(ctx, base, buf, ctx->cluster_size)) {
+        free(buf);
+        return 0;
+      }
+      const DirectoryEntry *ents = (const DirectoryEntry *)buf;
+      for (uint32_t i = 0; i < per; i++) {
+        if (ents[i].filename[0] == 0x00) {
+          end = 1;
+          break;
+        }
+        if (entry_named(&ents[i]) &&
+            !check_add(job, &ents[i], -1,
+                       base + (long)(i * sizeof(DirectoryEntry)),
+                       (int32_t)k)) {
+          free(buf);
+          return 0;
+        }
+      }
+    }
+  }
+  free(buf);
+  return 1;
+}
+
+#define CHK_CHAIN_BATCH 64
+#define CHK_LOST_BATCH 4096 /* clusters por lote, múltiplo de 64 */
+
+static void *check_chains_worker(void *arg) {
+  CheckJob *job = (CheckJob *)arg;
+  for (;;) {
+    uint32_t k = __atomic_fetch_add(&job->next, CHK_CHAIN_BATCH,
+                                    __ATOMIC_RELAXED);
+    if (k >= job->nchains) {
+      stats_flush_local(job->ctx);
+      return NULL;
+    }
+    uint32_t end = k + CHK_CHAIN_BATCH;
+    if (end > job->nchains)
+      end = job->nchains;
+    for (; k < end; k++)
+      if (!job->chains[k].is_dir)
+        check_walk(job->ctx, job->owned, &job->chains[k]);
+  }
+}
+
+static int cluster_lost(const Fat16Ctx *ctx, const uint64_t *owned,
+                        uint32_t c) {
+  uint16_t v = ctx->fat[c];
+  return v != FAT16_FREE && v != FAT16_BAD &&
+         !(owned[c >> 6] & (1ull << (c & 63)));
+}
+
+static void *check_lost_worker(void *arg) {
+  CheckJob *job = (CheckJob *)arg;
+  Fat16Ctx *ctx = job->ctx;
+  for (;;) {
+    uint32_t c = __atomic_fetch_add(&job->next, CHK_LOST_BATCH,
+                                    __ATOMIC_RELAXED);
+    if (c >= ctx->cluster_limit)
+      return NULL;
+    uint32_t end = c + CHK_LOST_BATCH, lost = 0;
+    if (end > ctx->cluster_limit)
+      end = ctx->cluster_limit;
+    /* em uso e sem dono, 64 por vez: fora do índice de livres e fora do
+     * bitmap de dono; só esses candidatos consultam a FAT (BAD) */
+    for (uint32_t w = c >> 6; w < (end + 63) >> 6; w++) {
+      for (uint64_t m = ~ctx->free_map[w] & ~job->owned[w]; m; m &= m - 1) {
+        uint32_t x = (w << 6) + (uint32_t)__builtin_ctzll(m);
+        if (x >= 2 && x < end)
+          lost += (uint32_t)cluster_lost(ctx, job->owned, x);
+      }
+    }
+    __atomic_fetch_add(&job->lost, lost, __ATOMIC_RELAXED);
+  }
+}
+
+/* Roda fn em threads trabalhadores (o chamador é um deles). */
+static void check_parallel(CheckJob *job, int threads, void *(*fn)(void *)) {
+  pthread_t tid[16];
+  int started = 0;
+  job->next = 0;
+  for (int i = 1; i < threads && i < 16; i++)
+    if (pthread_create(&tid[started], NULL, fn, job) == 0)
+      started++;
+  fn(job);
+  for (int i = 0; i < started; i++)
+    pthread_join(tid[i], NULL);
+}
+
+/* Compara cada cópia da FAT na imagem com a FAT em memória; com reparo,
+ * marca os setores divergentes para serem regravados em todas as cópias.
+ * Retorna quantos setores divergem em alguma cópia (-1 em erro). */
+static long check_fat_mirrors(Fat16Ctx *ctx, int repair) {
+  uint32_t bps = ctx->bpb.bytes_per_sector;
+  uint8_t *copy = (uint8_t *)malloc(ctx->fat_size_bytes);
+  uint8_t *bad = (uint8_t *)calloc(ctx->bpb.fat_size_16 + 1u, 1);
+  if (!copy || !bad) {
+    free(copy);
+    free(bad);
+    return -1;
+  }
+  long first = (long)ctx->bpb.reserved_sectors * (long)bps;
+  long n = 0;
+  for (int i = 0; i < ctx->bpb.num_fats; i++) {
+    if (ctx->map && i == 0)
+      continue; /* FAT 0 é a própria FAT em memória */
+    if (!img_read(ctx, first + (long)i * (long)ctx->fat_size_bytes, copy,
+                  ctx->fat_size_bytes)) {
+      n = -1;
+      break;
+    }
+    for (uint32_t s = 0; s < ctx->bpb.fat_size_16; s++) {
+      if (bad[s] || memcmp(copy + (size_t)s * bps,
+                           (const uint8_t *)ctx->fat + (size_t)s * bps,
+                           bps) == 0)
+        continue;
+      bad[s] = 1;
+      n++;
+      if (repair)
+        ctx->fat_dirty[s] = 1;
+    }
+  }
+  free(copy);
+  free(bad);
+  return n;
+}
+
+/* Corta a cadeia de ch depois de keep clusters próprios, liberando o resto
+ * que for dela (até o cluster cruzado, se houver). */
+static void check_truncate(Fat16Ctx *ctx, CheckChain *ch, uint32_t keep) {
+  uint16_t c = ch->first, last = 0;
+  for (uint32_t n = 0; n < keep; n++) {
+    last = c;
+    c = fat_next(ctx, c);
+  }
+  uint32_t extra = ch->len - keep;
+  if (last)
+    fat_set(ctx, last, FAT16_EOF);
+  else
+    ch->first = 0;
+  for (uint32_t n = 0; n < extra; n++) {
+    uint16_t nx = fat_next(ctx, c);
+    fat_set(ctx, c, FAT16_FREE);
+    c = nx;
+  }
+  ch->len = keep;
+}
+
+/* Grava first/size corrigidos na entrada de diretório de ch. */
+static int check_store(Fat16Ctx *ctx, const CheckChain *ch) {
+  if (ch->root_idx >= 0) {
+    DirectoryEntry *e = &ctx->root[ch->root_idx];
+    e->first_cluster_low = ch->first;
+    e->file_size = ch->size;
+    root_touch(ctx, e);
+    return 1;
+  }
+  DirectoryEntry e;
+  if (!img_read(ctx, ch->ent_off, &e, sizeof(e)))
+    return 0;
+  e.first_cluster_low = ch->first;
+  e.file_size = ch->size;
+  return img_write(ctx, ch->ent_off, &e, sizeof(e));
+}
+
+static int check_volume(Fat16Ctx *ctx, unsigned flags, int threads,
+                        Fat16CheckReport *rep) {
+  int repair = (flags & FAT16_CHECK_REPAIR) != 0;
+  memset(rep, 0, sizeof(*rep));
+  if (threads <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (ctx->cluster_count >= 32768 && cpus > 1) ? (int)cpus : 1;
+  }
+  if (threads > 16)
+    threads = 16;
+  if (repair)
+    threads = 1;
+  /* com journal, a FAT em disco só fica igual à da memória depois do
+   * commit: sem ele as cópias pareceriam divergentes */
+  if (!meta_commit(ctx, 1)) {
+    printf("Erro ao gravar os metadados pendentes; verificação cancelada.\n");
+    return -1;
+  }
+
+  CheckJob job;
+  memset(&job, 0, sizeof(job));
+  job.ctx = ctx;
+  job.owned = (uint64_t *)calloc(ctx->cluster_limit / 64 + 1,
+                                 sizeof(uint64_t));
+  long mirrors = check_fat_mirrors(ctx, repair);
+  if (!job.owned || mirrors < 0 || !check_collect(&job)) {
+    printf("Falha ao ler a imagem para a verificação.\n");
+    free(job.owned);
+    free(job.chains);
+    return -1;
+  }
+  rep->fat_mismatch = (uint32_t)mirrors;
+  check_parallel(&job, threads, check_chains_worker);
+  check_parallel(&job, threads, check_lost_worker);
+  rep->lost = job.lost;
+
+  uint32_t cs = ctx->cluster_size;
+  int meta_ok = 1;
+  for (uint32_t k = 0; k < job.nchains; k++) {
+    CheckChain *ch = &job.chains[k];
+    int changed = 0;
+    /* check_truncate pode mudar ou zerar ch->first; o cache de extents é
+     * chaveado pelo valor antigo */
+    uint16_t first = ch->first;
+    if (ch->is_dir)
+      rep->dirs++;
+    else
+      rep->files++;
+    if (ch->status == CHK_CROSS) {
+      rep->cross_linked++;
+      printf("'%s': ligação cruzada no cluster %u.\n", ch->name, ch->cross);
+    } else if (ch->status == CHK_BROKEN) {
+      rep->bad_chain++;
+      printf("'%s': cadeia inválida após %u cluster(s).\n", ch->name,
+             ch->len);
+    }
+    if (repair && ch->status != CHK_OK) {
+      check_truncate(ctx, ch, ch->len);
+      changed = 1;
+    }
+    if (!ch->is_dir) {
+      uint32_t need = (uint32_t)(((uint64_t)ch->size + cs - 1) / cs);
+      /* arquivo vazio pode ter um cluster reservado (como no create) */
+      uint32_t max = need ? need : 1;
+      if (ch->len < need || ch->len > max) {
+        rep->size_mismatch++;
+        printf("'%s': %u bytes, mas a cadeia tem %u cluster(s).\n", ch->name,
+               ch->size, ch->len);
+        if (repair) {
+          if (ch->len > max)
+            check_truncate(ctx, ch, max);
+          else
+            ch->size = ch->len * cs;
+          changed = 1;
+        }
+      }
+    }
+    if (changed) {
+      ext_cache_invalidate(ctx, first);
+      meta_ok &= check_store(ctx, ch);
+      rep->repaired++;
+    }
+  }
+
+  if (repair && rep->lost) {
+    for (uint32_t c = 2; c < ctx->cluster_limit; c++)
+      if (cluster_lost(ctx, job.owned, c))
+        fat_set(ctx, c, FAT16_FREE);
+    rep->repaired += rep->lost;
+  }
+  if (repair && rep->fat_mismatch)
+    rep->repaired += rep->fat_mismatch;
+  if (repair && rep->repaired) {
+    dir_cache_reset(ctx);
+    meta_ok &= meta_commit(ctx, 1);
+    img_sync(ctx);
+    if (!meta_ok)
+      printf("Erro ao gravar os reparos.\n");
+  }
+
+  uint32_t problems = rep->cross_linked + rep->bad_chain + rep->size_mismatch +
+                      rep->lost + rep->fat_mismatch;
+  printf("Verificados: %u arquivo(s), %u pasta(s), %u thread(s).\n",
+         rep->files, rep->dirs, (unsigned)threads);
+  printf("Cruzadas=%u  Cadeias inválidas=%u  Tamanhos=%u  Perdidos=%u  "
+         "Setores FAT divergentes=%u\n",
+         rep->cross_linked, rep->bad_chain, rep->size_mismatch, rep->lost,
+         rep->fat_mismatch);
+  if (problems == 0)
+    printf("Volume consistente.\n");
+  else if (repair)
+    printf("Reparos aplicados: %u.\n", rep->repaired);
+  free(job.owned);
+  free(job.chains);
+  return (int)problems;
+}
+
+/* ===== Desfragmentação =====
+ * Para cada arquivo fragmentado escolhe uma janela [s, s+len) onde a
+ * cadeia inteira caiba contígua, entre: alinhar um dos maiores extents do
+ * arquivo onde ele já está (só os clusters fora do lugar são copiados) ou
+ * a menor corrida livre que comporta o arquivo. Vale a janela que exige
+ * menos cópias; todo destino precisa estar livre, então origem e destino
+ * nunca se sobrepõem. Os dados são copiados em lotes de até 1 MiB, depois a
+ * nova cadeia e a entrada são gravadas e só então os clusters antigos são
+ * liberados. Pastas não são movidas (as entradas "." e ".." apontam para
+ * elas) e arquivos com cadeia corrompida ficam como estão.
+ */
+
+#define DEFRAG_CANDIDATES 8 /* extents testados como âncora por arquivo */
+
+typedef struct {
+  uint64_t *busy; /* cópia do estado da FAT: 1 → cluster ocupado */
+  uint8_t *buf;
+  size_t cap;
+  IoReq *q;
+  int dry;
+} DefragState;
+
+static int bm_get(const uint64_t *bm, uint32_t c) {
+  return (int)((bm[c >> 6] >> (c & 63)) & 1);
+}
+
+static void bm_put(uint64_t *bm, uint32_t c, int v) {
+  if (v)
+    bm[c >> 6] |= 1ull << (c & 63);
+  else
+    bm[c >> 6] &= ~(1ull << (c & 63));
+}
+
+/* Menor corrida livre com pelo menos len clusters (0 se não há). */
+static uint32_t defrag_free_run(Fat16Ctx *ctx, const uint64_t *busy,
+                                uint32_t len) {
+  uint32_t best = 0, best_len = UINT32_MAX, c = 2;
+  while (c < ctx->cluster_limit) {
+    if (busy[c >> 6] == ~0ull) {
+      c = ((c >> 6) + 1) << 6;
+      continue;
+    }
+    if (bm_get(busy, c)) {
+      c++;
+      continue;
+    }
+    uint32_t s = c;
+    while (c < ctx->cluster_limit && !bm_get(busy, c))
+      c++;
+    if (c - s >= len && c - s < best_len) {
+      best = s;
+      best_len = c - s;
+    }
+  }
+  return best;
+}
+
+/* Clusters já no lugar se a cadeia for para [s, s+len); -1 se algum
+ * destino estiver ocupado por outro dado. */
+static long defrag_fit(Fat16Ctx *ctx, const uint64_t *busy,
+                       const uint16_t *cl, uint32_t len, long s) {
+  if (s < 2 || s + (long)len > (long)ctx->cluster_limit)
+    return -1;
+  long in = 0;
+  for (uint32_t i = 0; i < len; i++) {
+    if (cl[i] == (uint32_t)(s + (long)i))
+      in++;
+    else if (bm_get(busy, (uint32_t)(s + (long)i)))
+      return -1;
+  }
+  return in;
+}
+
+static uint32_t count_extents(const uint16_t *cl, uint32_t len) {
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < len; i++)
+    if (i == 0 || cl[i] != (uint16_t)(cl[i - 1] + 1))
+      n++;
+  return n;
+}
+
+/* Copia os clusters fora do lugar para s+i: uma escrita por corrida de
+ * destino (até cap bytes), com as leituras das origens em lote. */
+static int defrag_copy(Fat16Ctx *ctx, DefragState *st, const uint16_t *cl,
+                       uint32_t len, uint32_t s) {
+  uint32_t cs = ctx->cluster_size, per = (uint32_t)(st->cap / cs);
+  uint32_t i = 0;
+  while (i < len) {
+    if (cl[i] == s + i) {
+      i++;
+      continue;
+    }
+    uint32_t k = i, nq = 0;
+    while (k < len && k - i < per && cl[k] != s + k) {
+      uint8_t *dst = st->buf + (size_t)(k - i) * cs;
+      if (nq > 0 && cl[k] == (uint16_t)(cl[k - 1] + 1) &&
+          st->q[nq - 1].buf + st->q[nq - 1].len == dst) {
+        st->q[nq - 1].len += cs;
+      } else {
+        st->q[nq].off = cluster_offset(ctx, cl[k]);
+        st->q[nq].buf = dst;
+        st->q[nq].len = cs;
+        nq++;
+      }
+      k++;
+    }
+    if (!io_batch(ctx, 0, st->q, (int)nq) ||
+        !img_write(ctx, cluster_offset(ctx, (uint16_t)(s + i)), st->buf,
+                   (size_t)(k - i) * cs))
+      return 0;
+    i = k;
+  }
+  return 1;
+}
+
+/* Desfragmenta (ou só planeja, em simulação) o arquivo de ch. */
+static int defrag_file(Fat16Ctx *ctx, DefragState *st, CheckChain *ch,
+                       Fat16DefragReport *rep) {
+  uint32_t len = ch->len;
+  uint16_t *cl = (uint16_t *)malloc(sizeof(uint16_t) * (len ? len : 1));
+  if (!cl)
+    return 0;
+  uint16_t c = ch->first;
+  for (uint32_t i = 0; i < len; i++, c = fat_next(ctx, c))
+    cl[i] = c;
+  uint32_t before = count_extents(cl, len);
+  rep->files++;
+  rep->extents_before += before;
+  if (before <= 1) {
+    rep->extents_after += before;
+    free(cl);
+    return 1;
+  }
+  rep->fragmented++;
+
+  /* âncoras: os maiores extents do arquivo, mantidos onde estão */
+  long best_s = -1, best_in = -1;
+  uint32_t anchor[DEFRAG_CANDIDATES], alen[DEFRAG_CANDIDATES];
+  int na = 0;
+  for (uint32_t i = 0; i < len;) {
+    uint32_t k = i + 1;
+    while (k < len && cl[k] == (uint16_t)(cl[k - 1] + 1))
+      k++;
+    int slot = na < DEFRAG_CANDIDATES ? na++ : -1;
+    if (slot < 0) {
+      slot = 0;
+      for (int a = 1; a < na; a++)
+        if (alen[a] < alen[slot])
+          slot = a;
+      if (alen[slot] >= k - i)
+        slot = -1;
+    }
+    if (slot >= 0) {
+      anchor[slot] = i;
+      alen[slot] = k - i;
+    }
+    i = k;
+  }
+  for (int a = 0; a < na; a++) {
+    long s = (long)cl[anchor[a]] - (long)anchor[a];
+    long in = defrag_fit(ctx, st->busy, cl, len, s);
+    if (in > best_in) {
+      best_in = in;
+      best_s = s;
+    }
+  }
+  if (best_in < 0) {
+    uint32_t s = defrag_free_run(ctx, st->busy, len);
+    if (s) {
+      best_s = s;
+      best_in = 0;
+    }
+  }
+  if (best_s < 0) {
+    printf("'%s': %u extent(s), sem espaço contíguo.\n", ch->name, before);
+    rep->extents_after += before;
+    free(cl);
+    return 1;
+  }
+
+  uint32_t s = (uint32_t)best_s, moved = len - (uint32_t)best_in;
+  printf("'%s': %u extent(s) -> 1 (%u cluster(s) copiados)\n", ch->name,
+         before, moved);
+  if (!st->dry) {
+    if (!defrag_copy(ctx, st, cl, len, s)) {
+      printf("Falha ao copiar '%s'.\n", ch->name);
+      free(cl);
+      return 0;
+    }
+    /* nova cadeia e entrada primeiro; os clusters antigos só depois */
+    uint16_t old_first = ch->first;
+    for (uint32_t i = 0; i < len; i++)
+      fat_set(ctx, (uint16_t)(s + i),
+              i + 1 < len ? (uint16_t)(s + i + 1) : FAT16_EOF);
+    ch->first = (uint16_t)s;
+    ext_cache_invalidate(ctx, old_first);
+    if (!check_store(ctx, ch) || !meta_commit(ctx, 1)) {
+      printf("Erro ao gravar metadados.\n");
+      free(cl);
+      return 0;
+    }
+    ClusterRun *runs = NULL;
+    int nruns = 0, rcap = 0;
+    for (uint32_t i = 0; i < len; i++) {
+      if (cl[i] == s + i)
+        continue;
+      fat_set(ctx, cl[i], FAT16_FREE);
+      if (ctx->sparse)
+        run_add(&runs, &nruns, &rcap, cl[i]);
+    }
+    if (!meta_commit(ctx, 1)) {
+      printf("Erro ao gravar metadados.\n");
+      free(runs);
+      free(cl);
+      return 0;
+    }
+    for (int r = 0; r < nruns; r++)
+      img_punch(ctx, cluster_offset(ctx, runs[r].start),
+                (size_t)runs[r].len * ctx->cluster_size);
+    free(runs);
+  }
+  for (uint32_t i = 0; i < len; i++) {
+    if (cl[i] != s + i) {
+      bm_put(st->busy, cl[i], 0);
+      bm_put(st->busy, s + i, 1);
+    }
+  }
+  rep->extents_after += 1;
+  rep->clusters_moved += moved;
+  free(cl);
+  return 1;
+}
+
+static int defrag_volume(Fat16Ctx *ctx, unsigned flags,
+                         Fat16DefragReport *rep) {
+  memset(rep, 0, sizeof(*rep));
+  DefragState st;
+  memset(&st, 0, sizeof(st));
+  st.dry = (flags & FAT16_DEFRAG_DRY_RUN) != 0;
+  st.cap = (ctx->cluster_size > (1u << 20)) ? ctx->cluster_size : (1u << 20);
+  st.cap -= st.cap % ctx->cluster_size;
+  st.buf = (uint8_t *)malloc(st.cap);
+  st.q = (IoReq *)malloc(sizeof(IoReq) * (st.cap / ctx->cluster_size));
+  st.busy = (uint64_t *)calloc(ctx->cluster_limit / 64 + 1, sizeof(uint64_t));
+
+  /* as entradas (raiz e subdiretórios) vêm do coletor do fsck */
+  CheckJob job;
+  memset(&job, 0, sizeof(job));
+  job.ctx = ctx;
+  job.owned = (uint64_t *)calloc(ctx->cluster_limit / 64 + 1,
+                                 sizeof(uint64_t));
+  int ok = st.buf && st.q && st.busy && job.owned && check_collect(&job) &&
+           (st.dry || meta_before_alloc(ctx));
+  if (!ok)
+    printf("Falha ao preparar a desfragmentação.\n");
+  if (ok) {
+    /* ocupados: complemento do índice de livres (inclui os clusters 0 e
+     * 1 e o que passa de cluster_limit na última palavra) */
+    for (uint32_t w = 0; w < ctx->free_words; w++)
+      st.busy[w] = ~ctx->free_map[w];
+    for (uint32_t k = 0; k < job.nchains; k++)
+      if (!job.chains[k].is_dir)
+        check_walk(ctx, job.owned, &job.chains[k]);
+    printf("Desfragmentação%s:\n", st.dry ? " (simulação)" : "");
+    for (uint32_t k = 0; k < job.nchains && ok; k++) {
+      CheckChain *ch = &job.chains[k];
+      if (ch->is_dir || ch->first == 0)
+        continue;
+      if (ch->status != CHK_OK) {
+        printf("'%s': cadeia inválida, ignorado (use check).\n", ch->name);
+        continue;
+      }
+      ok = defrag_file(ctx, &st, ch, rep);
+    }
+    if (!st.dry) {
+      dir_cache_reset(ctx);
+      img_sync(ctx);
+    }
+    printf("Arquivos: %u (%u fragmentado(s))  Extents: %u -> %u  "
+           "Clusters copiados: %u\n",
+           rep->files, rep->fragmented, rep->extents_before,
+           rep->extents_after, rep->clusters_moved);
+  }
+  free(st.buf);
+  free(st.q);
+  free(st.busy);
+  free(job.owned);
+  free(job.chains);
+  return ok;
+}
+
+/* ===== Extração do volume (extract) =====
+ * Copia todos os arquivos (raiz e subdiretórios) para um diretório do host
+ * sem ler arquivo por arquivo: monta o mapa de extents de todos eles,
+ * ordena por cluster físico e varre a área de dados uma vez, em ordem
+ * crescente, com leituras de até 1 MiB. Buracos pequenos entre extents são
+ * lidos junto para não quebrar a leitura sequencial. Cada pedaço vai com
+ * pwrite para o arquivo de destino, no offset certo.
+ */
+#define EXTRACT_GAP 16 /* clusters de buraco lidos junto, no máximo */
+#define EXTRACT_FDS 64 /* descritores de destino abertos ao mesmo tempo */
+#define EXTRACT_DEPTH 64 /* níveis de pasta no caminho de destino */
+
+typedef struct {
+  uint16_t start;    /* 1º cluster físico */
+  uint16_t clusters; /* clusters contíguos */
+  uint32_t chain;    /* índice em job.chains */
+  uint32_t file_off; /* offset no arquivo de destino */
+  uint32_t bytes;    /* bytes úteis (o último cluster pode ser parcial) */
+} ExtractPiece;
+
+typedef struct {
+  const char *dir;
+  CheckJob *job;
+  int fd[EXTRACT_FDS]; /* mapeamento direto: chain % EXTRACT_FDS */
+  uint32_t fd_chain[EXTRACT_FDS];
+} ExtractOut;
+
+static int piece_by_start(const void *a, const void *b) {
+  const ExtractPiece *x = (const ExtractPiece *)a, *y = (const ExtractPiece *)b;
+  return (x->start > y->start) - (x->start < y->start);
+}
+
+/* Caminho no host de job->chains[k]: dir/PASTA/SUB/NOME.EXT. */
+static int extract_path(const ExtractOut *o, uint32_t k, char *out,
+                        size_t n) {
+  const char *parts[EXTRACT_DEPTH];
+  int depth = 0;
+  for (int32_t p = (int32_t)k; p >= 0; p = o->job->chains[p].parent) {
+    if (depth == EXTRACT_DEPTH)
+      return 0;
+    parts[depth++] = o->job->chains[p].name;
+  }
+  int len = snprintf(out, n, "%s", o->dir);
+  for (int i = depth - 1; i >= 0 && len >= 0 && (size_t)len < n; i--)
+    len += snprintf(out + len, n - (size_t)len, "/%s", parts[i]);
+  return len >= 0 && (size_t)len < n;
+}
+
+/* Descritor do destino de chain (abre se preciso, fechando o que ocupava
+ * a posição). Os arquivos já foram criados vazios. */
+static int extract_fd(ExtractOut *o, uint32_t chain) {
+  int slot = (int)(chain % EXTRACT_FDS);
+  if (o->fd[slot] >= 0 && o->fd_chain[slot] == chain)
+    return o->fd[slot];
+  if (o->fd[slot] >= 0)
+    close(o->fd[slot]);
+  char path[1024];
+  o->fd[slot] = extract_path(o, chain, path, sizeof(path))
+                    ? open(path, O_WRONLY)
+                    : -1;
+  o->fd_chain[slot] = chain;
+  return o->fd[slot];
+}
+
+/* Corta a cadeia de ch em pedaços contíguos de até max clusters. */
+static int extract_pieces(Fat16Ctx *ctx, const CheckChain *ch, uint32_t k,
+                          uint32_t max, ExtractPiece **ps, uint32_t *n,
+                          uint32_t *cap) {
+  uint16_t c = ch->first;
+  uint32_t off = 0;
+  for (uint32_t i = 0; i < ch->len && off < ch->size;) {
+    uint16_t start = c;
+    uint32_t run = 1;
+    c = fat_next(ctx, c);
+    i++;
+    while (i < ch->len && run < max && c == start + run) {
+      c = fat_next(ctx, c);
+      run++;
+      i++;
+    }
+    if (*n == *cap) {
+      uint32_t ncap = *cap ? *cap * 2 : 1024;
+      ExtractPiece *p = (ExtractPiece *)realloc(*ps, sizeof(ExtractPiece) *
+                                                         (size_t)ncap);
+      if (!p)
+        return 0;
+      *ps = p;
+      *cap = ncap;
+    }
+    uint32_t bytes = run * ctx->cluster_size;
+    if (bytes > ch->size - off)
+      bytes = ch->size - off;
+    ExtractPiece *p = &(*ps)[(*n)++];
+    p->start = start;
+    p->clusters = (uint16_t)run;
+    p->chain = k;
+    p->file_off = off;
+    p->bytes = bytes;
+    off += bytes;
+  }
+  return 1;
+}
+
+static int extract_volume(Fat16Ctx *ctx, const char *dir,
+                          Fat16ExtractReport *rep) {
+  memset(rep, 0, sizeof(*rep));
+  CheckJob job;
+  memset(&job, 0, sizeof(job));
+  job.ctx = ctx;
+  job.owned = (uint64_t *)calloc(ctx->cluster_limit / 64 + 1,
+                                 sizeof(uint64_t));
+  uint32_t cap = (ctx->cluster_size > (1u << 20)) ? ctx->cluster_size
+                                                  : (1u << 20);
+  uint32_t max = cap / ctx->cluster_size;
+  uint8_t *buf = (uint8_t *)malloc(cap);
+  ExtractPiece *ps = NULL;
+  uint32_t np = 0, pcap = 0;
+  ExtractOut o;
+  o.dir = dir;
+  o.job = &job;
+  for (int i = 0; i < EXTRACT_FDS; i++)
+    o.fd[i] = -1;
+
+  int ok = job.owned && buf && check_collect(&job);
+  if (!ok)
+    printf("Falha ao ler os diretórios.\n");
+  if (ok && mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    printf("Não consegui criar '%s'.\n", dir);
+    ok = 0;
+  }
+
+  /* pastas e arquivos vazios no host, e o mapa de pedaços */
+  for (uint32_t k = 0; ok && k < job.nchains; k++) {
+    CheckChain *ch = &job.chains[k];
+    for (char *s = ch->name; *s; s++)
+      if (*s == '/')
+        *s = '_';
+    char path[1024];
+    if (!extract_path(&o, k, path, sizeof(path))) {
+      printf("Caminho longo demais: '%s'.\n", ch->name);
+      rep->skipped++;
+      continue;
+    }
+    if (ch->is_dir) {
+      if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        printf("Não consegui criar '%s'.\n", path);
+        ok = 0;
+      }
+      rep->dirs++;
+      continue;
+    }
+    check_walk(ctx, job.owned, ch);
+    uint64_t need = ((uint64_t)ch->size + ctx->cluster_size - 1) /
+                    ctx->cluster_size;
+    if (ch->status != CHK_OK || ch->len < need) {
+      printf("'%s': cadeia inválida, ignorado (use check).\n", path);
+      rep->skipped++;
+      continue;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)ch->size) != 0) {
+      printf("Não consegui criar '%s'.\n", path);
+      if (fd >= 0)
+        close(fd);
+      ok = 0;
+      break;
+    }
+    close(fd);
+    rep->files++;
+    rep->bytes += ch->size;
+    if (!extract_pieces(ctx, ch, k, max, &ps, &np, &pcap)) {
+      printf("Memória insuficiente.\n");
+      ok = 0;
+    }
+  }
+
+  /* uma varredura crescente da área de dados */
+  qsort(ps, np, sizeof(ExtractPiece), piece_by_start);
+  for (uint32_t i = 0; ok && i < np;) {
+    uint32_t first = ps[i].start, end = first + ps[i].clusters, j = i + 1;
+    while (j < np && ps[j].start <= end + EXTRACT_GAP &&
+           ps[j].start + ps[j].clusters - first <= max) {
+      if (ps[j].start + ps[j].clusters > end)
+        end = ps[j].start + ps[j].clusters;
+      j++;
+    }
+    /* até o último byte útil: o último cluster de um arquivo pode passar
+     * do fim do arquivo da imagem */
+    size_t len = 0;
+    for (uint32_t k = i; k < j; k++) {
+      size_t e = (size_t)(ps[k].start - first) * ctx->cluster_size +
+                 ps[k].bytes;
+      if (e > len)
+        len = e;
+    }
+    if (!img_read(ctx, cluster_offset(ctx, (uint16_t)first), buf, len)) {
+      printf("Falha leitura.\n");
+      ok = 0;
+      break;
+    }
+    rep->reads++;
+    for (; i < j; i++) {
+      int fd = extract_fd(&o, ps[i].chain);
+      const uint8_t *src = buf + (size_t)(ps[i].start - first) *
+                                     ctx->cluster_size;
+      if (fd < 0 || pwrite(fd, src, ps[i].bytes, (off_t)ps[i].file_off) !=
+                        (ssize_t)ps[i].bytes) {
+        printf("Erro ao gravar '%s'.\n", job.chains[ps[i].chain].name);
+        ok = 0;
+        break;
+      }
+    }
+  }
+
+  for (int i = 0; i < EXTRACT_FDS; i++)
+    if (o.fd[i] >= 0)
+      close(o.fd[i]);
+  free(ps);
+  free(buf);
+  free(job.owned);
+  free(job.chains);
+  printf("Extraídos: %u arquivo(s), %u pasta(s), %llu bytes em %u "
+         "leitura(s)%s.\n",
+         rep->files, rep->dirs, (unsigned long long)rep->bytes, rep->reads,
+         rep->skipped ? " (houve itens ignorados)" : "");
+  return ok;
+}
+
+/* ----- Pontos de entrada públicos: leituras com trava compartilhada,
+ * alterações com trava exclusiva ----- */
+
+void fat16_list_dir(Fat16Ctx *ctx) {
+  uint64_t t0 = op_begin();
+  ctx_rdlock(ctx);
+  list_root(ctx);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_LIST_DIR, t0);
+}
+
+void fat16_list_path(Fat16Ctx *ctx, const char *path) {
+  uint64_t t0 = op_begin();
+  ctx_rdlock(ctx);
+  list_path(ctx, path);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_LIST_PATH, t0);
+}
+
+typedef struct {
+  DirectoryEntry *out;
+  int max;
+  int n;
+} ReaddirOut;
+
+static int readdir_entry(void *arg, const DirectoryEntry *e) {
+  ReaddirOut *ro = (ReaddirOut *)arg;
+  if (ro->n < ro->max)
+    ro->out[ro->n] = *e;
+  ro->n++;
+  return 0;
+}
+
+int fat16_readdir(Fat16Ctx *ctx, const char *path, DirectoryEntry *out,
+                  int max) {
+  uint64_t t0 = op_begin();
+  ctx_rdlock(ctx);
+  ReaddirOut ro = {out, max, 0};
+  DirectoryEntry d;
+  int r = resolve_path(ctx, path ? path : "", &d);
+  if (r == 2) {
+    for (int i = 0; i < ctx->bpb.root_entry_count; i++)
+      if (entry_named(&ctx->root[i]))
+        readdir_entry(&ro, &ctx->root[i]);
+    tl_dirents += ctx->bpb.root_entry_count;
+  } else if (r != 0 && (d.attributes & ATTR_DIRECTORY)) {
+    pthread_mutex_lock(&ctx->dcache_lock);
+    subdir_walk(ctx, d.first_cluster_low, readdir_entry, &ro);
+    pthread_mutex_unlock(&ctx->dcache_lock);
+  } else {
+    ro.n = -1;
+  }
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_READDIR, t0);
+  return ro.n;
+}
+
+void fat16_show_file(Fat16Ctx *ctx, const char *name83) {
+  uint64_t t0 = op_begin();
+  ctx_rdlock(ctx);
+  show_file(ctx, name83);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_SHOW_FILE, t0);
+}
+
+void fat16_show_attrs(Fat16Ctx *ctx, const char *name83) {
+  uint64_t t0 = op_begin();
+  ctx_rdlock(ctx);
+  show_attrs(ctx, name83);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_SHOW_ATTRS, t0);
+}
+
+int fat16_rename(Fat16Ctx *ctx, const char *old83, const char *new83) {
+  uint64_t t0 = op_begin();
+  ctx_wrlock(ctx);
+  int ok = rename_entry(ctx, old83, new83);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_RENAME, t0);
+  return ok;
+}
+
+int fat16_delete(Fat16Ctx *ctx, const char *name83) {
+  uint64_t t0 = op_begin();
+  ctx_wrlock(ctx);
+  int ok = delete_entry(ctx, name83);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_DELETE, t0);
+  return ok;
+}
+
+int fat16_defrag(Fat16Ctx *ctx, unsigned flags, Fat16DefragReport *rep) {
+  Fat16DefragReport local;
+  if (!rep)
+    rep = &local;
+  uint64_t t0 = op_begin();
+  ctx_wrlock(ctx);
+  int ok = defrag_volume(ctx, flags, rep);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_DEFRAG, t0);
+  return ok;
+}
+
+int fat16_extract(Fat16Ctx *ctx, const char *host_dir,
+                  Fat16ExtractReport *rep) {
+  Fat16ExtractReport local;
+  if (!rep)
+    rep = &local;
+  uint64_t t0 = op_begin();
+  ctx_rdlock(ctx);
+  int ok = extract_volume(ctx, host_dir, rep);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_EXTRACT, t0);
+  return ok;
+}
+
+int fat16_check(Fat16Ctx *ctx, unsigned flags, int threads,
+                Fat16CheckReport *rep) {
+  Fat16CheckReport local;
+  if (!rep)
+    rep = &local;
+  /* exclusiva mesmo sem reparo: o bitmap de dono exige uma FAT estável */
+  uint64_t t0 = op_begin();
+  ctx_wrlock(ctx);
+  int r = check_volume(ctx, flags, threads, rep);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_CHECK, t0);
+  return r;
+}
+
+/* ===== Importação de arquivos do host (create e lote) ===== */
+
+typedef struct {
+  const char *host; /* NULL → dados em mem (fat16_create_mem) */
+  const char *dest;
+  FILE *src;
+  const uint8_t *mem;
+  long size;
+  int need;
+  int extents;
+  uint16_t *chain;
+  DirectoryEntry *slot;
+  DirectoryEntry saved; /* conteúdo anterior do slot, para desfazer */
+  int failed;
+} ImportJob;
+
+/* Devolve o slot reservado e os clusters de um job que não vai ser criado. */
+static void import_undo(Fat16Ctx *ctx, ImportJob *j) {
+  if (j->chain) {
+    for (int i = 0; i < j->need; i++)
+      fat_set(ctx, j->chain[i], FAT16_FREE);
+    free(j->chain);
+    j->chain = NULL;
+  }
+  if (j->slot) {
+    int idx = (int)(j->slot - ctx->root);
+    name_index_del(ctx, idx);
+    *j->slot = j->saved;
+    slot_mark(ctx, idx, 1);
+    j->slot = NULL;
+  }
+  if (j->src) {
+    fclose(j->src);
+    j->src = NULL;
+  }
+}
+
+/* Fase 1: lê o tamanho da origem, reserva nome/slot na raiz e aloca a
+ * cadeia. A origem só é aberta na fase 2: um lote de centenas de arquivos
+ * não pode depender do limite de descritores abertos. */
+static int import_prepare(Fat16Ctx *ctx, ImportJob *j) {
+  if (j->host) { /* sem host, size já é o tamanho de mem */
+    struct stat st;
+    if (stat(j->host, &st) != 0 || !S_ISREG(st.st_mode)) {
+      printf("Não abri '%s'.\n", j->host);
+      return 0;
+    }
+    j->size = (long)st.st_size;
+  }
+  if (name_taken(ctx, j->dest)) {
+    printf("Já existe '%s'.\n", j->dest);
+    import_undo(ctx, j);
+    return 0;
+  }
+  DirectoryEntry *slot = find_free_dir(ctx);
+  if (!slot) {
+    printf("Diretório raiz cheio.\n");
+    import_undo(ctx, j);
+    return 0;
+  }
+
+  j->need = (int)((j->size + (long)ctx->cluster_size - 1) /
+                  (long)ctx->cluster_size);
+  if (j->need <= 0)
+    j->need = 1;
+
+  j->chain = (uint16_t *)malloc(sizeof(uint16_t) * (size_t)j->need);
+  if (!j->chain) {
+    printf("Memória insuficiente.\n");
+    import_undo(ctx, j);
+    return 0;
+  }
+  if (allocate_chain(ctx, j->need, j->chain, &j->extents) == 0) {
+    printf("Sem clusters livres suficientes.\n");
+    free(j->chain);
+    j->chain = NULL;
+    import_undo(ctx, j);
     return 0;
   }
-  compute_derived(ctx);
 
-  printf("Bytes/Setor=%u  Setores/Cluster=%u  #FATs=%u  RootEntries=%u\n",
-         ctx->bpb.bytes_per_sector, ctx->bpb.sectors_per_cluster,
-         ctx->bpb.num_fats, ctx->bpb.root_entry_count);
-  printf("FAT(setores)=%u  FirstDataSector=%u  ClustersDados=%u\n",
-         ctx->bpb.fat_size_16, ctx->first_data_sector, ctx->cluster_count);
+  /* reserva o slot já com o nome, para que outro job do mesmo lote não o
+   * pegue nem repita o nome */
+  int idx = (int)(slot - ctx->root);
+  j->saved = *slot;
+  j->slot = slot;
+  memset(slot, 0, sizeof(*slot));
+  fat16_to83(j->dest, slot->filename, slot->extension);
+  slot_mark(ctx, idx, 0);
+  name_index_add(ctx, idx);
   return 1;
 }
 
-int fat16_flush(Fat16Ctx *ctx) {
-  int ok = 1;
-  ok &= save_fat(ctx);
-  ok &= save_root(ctx);
-  fflush(ctx->img);
-  return ok;
-}
+/* Escritas pendentes da fase 2: corridas de um ou mais jobs acumuladas em
+ * buf e enviadas num lote só (io_batch). */
+typedef struct {
+  uint8_t *buf;
+  size_t cap, used;
+  IoReq *q;
+  int *job; /* job dono de cada pedido, para desfazer em caso de erro */
+  int n;
+} ImportBatch;
 
-void fat16_close(Fat16Ctx *ctx) {
-  if (ctx->root) {
-    free(ctx->root);
-    ctx->root = NULL;
-  }
-  if (ctx->fat) {
-    free(ctx->fat);
-    ctx->fat = NULL;
-  }
-  if (ctx->img) {
-    fclose(ctx->img);
-    ctx->img = NULL;
+static void import_flush(Fat16Ctx *ctx, ImportJob *jobs, ImportBatch *b) {
+  if (b->n > 0 && !io_batch(ctx, 1, b->q, b->n)) {
+    for (int i = 0; i < b->n; i++) {
+      ImportJob *j = &jobs[b->job[i]];
+      if (!j->failed)
+        printf("Falha ao gravar '%s'.\n", j->dest);
+      j->failed = 1;
+    }
   }
-  memset(ctx, 0, sizeof(*ctx));
+  b->n = 0;
+  b->used = 0;
 }
 
-void fat16_list_dir(Fat16Ctx *ctx) {
-  (void)ctx;
-  printf("\n========== DIRETÓRIO RAIZ ==========\n");
-  printf("%-13s %12s\n", "Arquivo", "Tamanho");
-  printf("------------------------------------\n");
+static int all_zero(const uint8_t *p, size_t n) {
+  return n == 0 || (p[0] == 0 && memcmp(p, p + 1, n - 1) == 0);
+}
 
-  int count = 0;
-  for (int i = 0; i < ctx->bpb.root_entry_count; i++) {
-    DirectoryEntry *e = &ctx->root[i];
-    if (!entry_regular(e))
-      continue;
-    char nm[13];
-    make_readable(e, nm);
-    printf("%-13s %12lu\n", nm, (unsigned long)e->file_size);
-    count++;
+/* Modo esparso: enfileira só os trechos com dados da corrida de n clusters
+ * que começa em first; clusters zerados viram buraco (os que ficam além do
+ * fim do arquivo da imagem, ou se o host recusar, são gravados). */
+static void import_queue_sparse(Fat16Ctx *ctx, ImportBatch *b, int ji,
+                                uint16_t first, uint8_t *data, int n) {
+  struct stat st;
+  long host_end = (fstat(fileno(ctx->img), &st) == 0) ? (long)st.st_size : 0;
+  size_t cs = ctx->cluster_size;
+  int i = 0;
+  while (i < n) {
+    int zero = all_zero(data + (size_t)i * cs, cs);
+    int k = i + 1;
+    while (k < n && all_zero(data + (size_t)k * cs, cs) == zero)
+      k++;
+    long off = cluster_offset(ctx, (uint16_t)(first + i));
+    size_t len = (size_t)(k - i) * cs;
+    if (!zero || off + (long)len > host_end || !img_punch(ctx, off, len)) {
+      b->q[b->n].off = off;
+      b->q[b->n].buf = data + (size_t)i * cs;
+      b->q[b->n].len = len;
+      b->job[b->n] = ji;
+      b->n++;
+    }
+    i = k;
   }
-  if (count == 0)
-    printf("(sem arquivos)\n");
-  printf("------------------------------------\n");
-  printf("Total: %d arquivo(s)\n", count);
 }
 
-void fat16_show_file(Fat16Ctx *ctx, const char *name83) {
-  DirectoryEntry *e = find_by_name(ctx, name83);
-  if (!e) {
-    printf("Arquivo '%s' não encontrado.\n", name83);
-    return;
+/*
+ * Copia len bytes de in (a partir de *soff) para a imagem em doff sem passar
+ * por espaço de usuário: copy_file_range (que pode virar reflink no host)
+ * e, se o host não suportar, sendfile. Retorna os bytes copiados (menos que
+ * len no fim da origem), -1 em erro de E/S ou -2 se nenhum dos dois serve
+ * (ctx->kcopy chega a 0 e o import segue pelo buffer).
+ */
+static long kcopy_range(Fat16Ctx *ctx, int in, off_t *soff, long doff,
+                        size_t len) {
+  int out = fileno(ctx->img);
+  size_t done = 0;
+  while (done < len && ctx->kcopy > 0) {
+    ssize_t r;
+    if (ctx->kcopy == 2) {
+      off_t d = (off_t)doff + (off_t)done;
+      r = copy_file_range(in, soff, out, &d, len - done, 0);
+    } else if (lseek(out, (off_t)doff + (off_t)done, SEEK_SET) < 0) {
+      r = -1;
+    } else {
+      r = sendfile(out, in, soff, len - done);
+    }
+    if (r > 0) {
+      io_count(ctx, 1, doff + (long)done, (size_t)r);
+      done += (size_t)r;
+      continue;
+    }
+    if (r == 0)
+      break; /* fim da origem */
+    if (errno == EINTR)
+      continue;
+    if (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+        errno == EOPNOTSUPP || errno == EBADF) {
+      ctx->kcopy--; /* copy_file_range → sendfile → buffer */
+      continue;
+    }
+    return -1;
   }
-  uint32_t sz = 0;
-  uint8_t *data = read_chain(ctx, e, &sz);
-  if (!data && sz > 0)
-    return;
-  printf("\n--- Conteúdo de '%s' (%lu bytes) ---\n", name83, (unsigned long)sz);
-  for (uint32_t i = 0; i < sz; i++)
-    putchar(data ? data[i] : '\0');
-  putchar('\n');
-  free(data);
+  if (done < len && ctx->kcopy == 0)
+    return -2;
+  return (long)done;
 }
 
-void fat16_show_attrs(Fat16Ctx *ctx, const char *name83) {
-  DirectoryEntry *e = find_by_name(ctx, name83);
-  if (!e) {
-    printf("Arquivo '%s' não encontrado.\n", name83);
-    return;
+/* Fase 2 sem buffer: uma cópia no kernel por corrida de clusters contíguos
+ * da cadeia; o que sobra de cada corrida (fim do último cluster) é zerado.
+ * Retorna 1 se copiou, 0 em erro de E/S e -1 se o host não tem cópia no
+ * kernel (a origem volta ao início para a cópia pelo buffer). */
+static int import_kcopy(Fat16Ctx *ctx, ImportJob *j) {
+  static const uint8_t zeros[4096];
+  int in = fileno(j->src);
+  off_t soff = 0;
+  int i = 0;
+  while (i < j->need) {
+    int k = i + 1;
+    while (k < j->need && j->chain[k] == (uint16_t)(j->chain[k - 1] + 1))
+      k++;
+    long doff = cluster_offset(ctx, j->chain[i]);
+    size_t bytes = (size_t)(k - i) * ctx->cluster_size;
+    size_t want = 0;
+    if (soff < (off_t)j->size)
+      want = (size_t)((off_t)j->size - soff) < bytes
+                 ? (size_t)((off_t)j->size - soff)
+                 : bytes;
+    long got = want ? kcopy_range(ctx, in, &soff, doff, want) : 0;
+    if (got == -2) {
+      rewind(j->src);
+      return -1;
+    }
+    if (got < 0)
+      return 0;
+    for (size_t z = (size_t)got; z < bytes;) {
+      size_t n = bytes - z < sizeof(zeros) ? bytes - z : sizeof(zeros);
+      if (!img_write(ctx, doff + (long)z, zeros, n))
+        return 0;
+      z += n;
+    }
+    i = k;
   }
-
-  int d, m, y, hh, mm, ss;
-  printf("\nAtributos de: %s\n", name83);
-  printf("Tamanho: %lu bytes\n", (unsigned long)e->file_size);
-
-  decode_date(e->creation_date, &d, &m, &y);
-  decode_time(e->creation_time, &hh, &mm, &ss);
-  printf("Criado em:   %02d/%02d/%04d %02d:%02d:%02d\n", d, m, y, hh, mm, ss);
-
-  decode_date(e->last_mod_date, &d, &m, &y);
-  decode_time(e->last_mod_time, &hh, &mm, &ss);
-  printf("Modificado:  %02d/%02d/%04d %02d:%02d:%02d\n", d, m, y, hh, mm, ss);
-
-  printf("Atributos:\n");
-  printf("  RO: %s  Hidden: %s  System: %s  Archive: %s\n",
-         (e->attributes & ATTR_READ_ONLY) ? "Sim" : "Não",
-         (e->attributes & ATTR_HIDDEN) ? "Sim" : "Não",
-         (e->attributes & ATTR_SYSTEM) ? "Sim" : "Não",
-         (e->attributes & ATTR_ARCHIVE) ? "Sim" : "Não");
+  return 1;
 }
 
-void fat16_rename(Fat16Ctx *ctx, const char *old83, const char *new83) {
-  DirectoryEntry *e = find_by_name(ctx, old83);
-  if (!e) {
-    printf("Arquivo '%s' não encontrado.\n", old83);
-    return;
+/* Fase 2: copia os dados, um pedido por corrida de clusters contíguos
+ * (limitada a cap bytes); o último cluster é completado com zeros. Sem
+ * mmap/cache/esparso, a cópia é feita no kernel (import_kcopy). */
+static void import_write(Fat16Ctx *ctx, ImportJob *jobs, int ji,
+                         ImportBatch *b) {
+  ImportJob *j = &jobs[ji];
+  if (j->host) {
+    j->src = fopen(j->host, "rb");
+    if (!j->src) {
+      printf("Não abri '%s'.\n", j->host);
+      j->failed = 1;
+      return;
+    }
   }
-  if (find_by_name(ctx, new83)) {
-    printf("Já existe '%s'.\n", new83);
+  int kc = (ctx->kcopy && j->src) ? import_kcopy(ctx, j) : -1;
+  if (kc >= 0) {
+    if (kc == 0) {
+      printf("Falha ao gravar '%s'.\n", j->dest);
+      j->failed = 1;
+    }
+    fclose(j->src);
+    j->src = NULL;
     return;
   }
+  long pos = 0; /* próximo byte de mem */
+  uint32_t per_io = (uint32_t)(b->cap / ctx->cluster_size);
+  int i = 0;
+  while (i < j->need) {
+    int k = i + 1;
+    while (k < j->need && (uint32_t)(k - i) < per_io &&
+           j->chain[k] == (uint16_t)(j->chain[k - 1] + 1))
+      k++;
+    size_t bytes = (size_t)(k - i) * ctx->cluster_size;
+    if (b->used + bytes > b->cap)
+      import_flush(ctx, jobs, b);
+    uint8_t *dst = b->buf + b->used;
+    size_t got;
+    if (j->src) {
+      got = fread(dst, 1, bytes, j->src);
+    } else {
+      got = (size_t)(j->size - pos) < bytes ? (size_t)(j->size - pos) : bytes;
+      memcpy(dst, j->mem + pos, got);
+      pos += (long)got;
+    }
+    if (got < bytes)
+      memset(dst + got, 0, bytes - got);
+    b->used += bytes;
+    if (ctx->sparse) {
+      import_queue_sparse(ctx, b, ji, j->chain[i], dst, k - i);
+    } else {
+      b->q[b->n].off = cluster_offset(ctx, j->chain[i]);
+      b->q[b->n].buf = dst;
+      b->q[b->n].len = bytes;
+      b->job[b->n] = ji;
+      b->n++;
+    }
+    i = k;
+  }
+  if (j->src)
+    fclose(j->src);
+  j->src = NULL;
+}
 
-  char n[8], x[3];
-  fat16_to83(new83, n, x);
-  memcpy(e->filename, n, 8);
-  memcpy(e->extension, x, 3);
+/* Fase 3: preenche a entrada de diretório do job já gravado. */
+static void import_commit(Fat16Ctx *ctx, ImportJob *j) {
+  DirectoryEntry *slot = j->slot;
+  slot->attributes = ATTR_ARCHIVE;
+  slot->first_cluster_low = j->chain[0];
+  slot->file_size = (uint32_t)j->size;
+  ext_cache_invalidate(ctx, j->chain[0]);
 
   uint16_t d, t;
   now_fat(&d, &t);
-  e->last_mod_date = d;
-  e->last_mod_time = t;
-
-  if (!save_root(ctx)) {
-    printf("Erro ao salvar diretório.\n");
-    return;
-  }
-  fflush(ctx->img);
-  printf("Renomeado: '%s' -> '%s'\n", old83, new83);
+  slot->creation_date = d;
+  slot->creation_time = t;
+  slot->last_mod_date = d;
+  slot->last_mod_time = t;
+  slot->last_access_date = d;
+  root_touch(ctx, slot);
 }
 
-void fat16_delete(Fat16Ctx *ctx, const char *name83) {
-  DirectoryEntry *e = find_by_name(ctx, name83);
-  if (!e) {
-    printf("Arquivo '%s' não encontrado.\n", name83);
-    return;
+/*
+ * Importa n arquivos: reserva slots e cadeias de todos, grava os dados e só
+ * então salva FAT e raiz uma única vez. Arquivos com problema são pulados.
+ * Retorna quantos foram criados.
+ */
+static int import_files(Fat16Ctx *ctx, const char *const *hosts,
+                        const char *const *dests, int n, const void *mem,
+                        size_t mem_len) {
+  ImportJob *jobs = (ImportJob *)calloc((size_t)(n > 0 ? n : 1),
+                                        sizeof(ImportJob));
+  if (!jobs) {
+    printf("Memória insuficiente.\n");
+    return 0;
+  }
+  /* sem o commit, os clusters liberados no grupo ainda são da FAT em disco */
+  if (!meta_before_alloc(ctx)) {
+    printf("Erro ao gravar o journal.\n");
+    free(jobs);
+    return 0;
+  }
+  int ok = 0;
+  for (int i = 0; i < n; i++) {
+    jobs[i].host = hosts ? hosts[i] : NULL;
+    jobs[i].dest = dests[i];
+    jobs[i].mem = (const uint8_t *)mem;
+    jobs[i].size = (long)mem_len;
+    import_prepare(ctx, &jobs[i]);
   }
 
-  uint16_t c = e->first_cluster_low;
-  uint32_t steps = 0;
-  while (c >= 2 && c < ctx->fat_entries && c < FAT16_EOF_MIN) {
-    uint16_t nx = ctx->fat[c];
-    ctx->fat[c] = FAT16_FREE;
-    c = nx;
-    if (++steps > ctx->cluster_count + 8) {
-      printf("Loop suspeito.\n");
-      break;
+  /* buffer do tamanho do lote, até 1 MiB (um create pequeno não precisa
+   * de mais) */
+  size_t max = (ctx->cluster_size > (1u << 20)) ? ctx->cluster_size
+                                                : (1u << 20);
+  max -= max % ctx->cluster_size;
+  ImportBatch b;
+  memset(&b, 0, sizeof(b));
+  b.cap = ctx->cluster_size;
+  size_t total = 0;
+  for (int i = 0; i < n && total < max; i++)
+    if (jobs[i].slot)
+      total += (size_t)jobs[i].need * ctx->cluster_size;
+  if (total > b.cap)
+    b.cap = total < max ? total : max;
+  size_t maxq = b.cap / ctx->cluster_size;
+  b.buf = (uint8_t *)malloc(b.cap);
+  b.q = (IoReq *)malloc(sizeof(IoReq) * maxq);
+  b.job = (int *)malloc(sizeof(int) * maxq);
+  int have_buf = b.buf && b.q && b.job;
+  if (!have_buf)
+    printf("Memória insuficiente.\n");
+
+  for (int i = 0; i < n; i++) {
+    if (!jobs[i].slot)
+      continue;
+    if (have_buf)
+      import_write(ctx, jobs, i, &b);
+    else
+      jobs[i].failed = 1;
+  }
+  import_flush(ctx, jobs, &b);
+  for (int i = 0; i < n; i++) {
+    if (!jobs[i].slot)
+      continue;
+    if (jobs[i].failed) {
+      import_undo(ctx, &jobs[i]);
+      continue;
     }
+    import_commit(ctx, &jobs[i]);
+    ok++;
   }
-  e->filename[0] = (char)0xE5; /* marca deletado */
 
-  if (!save_fat(ctx) || !save_root(ctx)) {
-    printf("Erro ao salvar.\n");
-    return;
+  dir_cache_reset(ctx);
+  int saved = meta_commit(ctx, 0);
+  if (!saved)
+    printf("Erro ao gravar metadados.\n");
+  img_sync(ctx);
+
+  for (int i = 0; i < n; i++) {
+    if (jobs[i].chain && saved)
+      printf("Criado '%s' (%ld bytes, %d extent(s)).\n", jobs[i].dest,
+             jobs[i].size, jobs[i].extents);
+    free(jobs[i].chain);
   }
-  fflush(ctx->img);
-  printf("Removido: '%s'\n", name83);
+  free(b.buf);
+  free(b.q);
+  free(b.job);
+  free(jobs);
+  return saved ? ok : 0;
 }
 
-void fat16_create(Fat16Ctx *ctx, const char *host_src, const char *dest83) {
-  FILE *src = fopen(host_src, "rb");
-  if (!src) {
-    printf("Não abri '%s'.\n", host_src);
-    return;
-  }
+int fat16_create(Fat16Ctx *ctx, const char *host_src, const char *dest83) {
+  uint64_t t0 = op_begin();
+  ctx_wrlock(ctx);
+  int ok = import_files(ctx, &host_src, &dest83, 1, NULL, 0);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_CREATE, t0);
+  return ok;
+}
 
-  if (find_by_name(ctx, dest83)) {
-    printf("Já existe '%s'.\n", dest83);
-    fclose(src);
-    return;
-  }
-  DirectoryEntry *slot = find_free_dir(ctx);
-  if (!slot) {
-    printf("Diretório raiz cheio.\n");
-    fclose(src);
-    return;
+int fat16_create_mem(Fat16Ctx *ctx, const char *dest83, const void *buf,
+                     size_t len) {
+  if (len > (size_t)UINT32_MAX) {
+    printf("Arquivo passaria de 4 GiB.\n");
+    return 0;
   }
+  uint64_t t0 = op_begin();
+  ctx_wrlock(ctx);
+  int ok = import_files(ctx, NULL, &dest83, 1, buf, len);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_CREATE, t0);
+  return ok;
+}
 
-  if (fseek(src, 0, SEEK_END) != 0) {
-    fclose(src);
-    return;
+int fat16_import_batch(Fat16Ctx *ctx, const char *const *host_paths,
+                       const char *const *dest83, int n) {
+  const char **names = (const char **)malloc(sizeof(char *) *
+                                             (size_t)(n > 0 ? n : 1));
+  if (!names) {
+    printf("Memória insuficiente.\n");
+    return 0;
   }
-  long fsz = ftell(src);
-  if (fsz < 0) {
-    fclose(src);
-    return;
+  /* sem nome destino: usa o nome do arquivo no host */
+  for (int i = 0; i < n; i++) {
+    const char *base = strrchr(host_paths[i], '/');
+    names[i] = (dest83 && dest83[i]) ? dest83[i]
+                                     : (base ? base + 1 : host_paths[i]);
   }
-  if (fseek(src, 0, SEEK_SET) != 0) {
-    fclose(src);
-    return;
+  uint64_t t0 = op_begin();
+  ctx_wrlock(ctx);
+  int ok = import_files(ctx, host_paths, names, n, NULL, 0);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_IMPORT, t0);
+  printf("Importados: %d de %d arquivo(s).\n", ok, n);
+  free(names);
+  return ok;
+}
+
+/* ===== Escrita no lugar (write_at, append, truncate) =====
+ * Alteram um arquivo da raiz sem recriá-lo: a cadeia existente é mantida,
+ * cresce a partir do último cluster (de preferência nos clusters livres
+ * logo depois dele) ou é liberada a partir do fim, e só os clusters tocados
+ * são gravados. Dados vão para a imagem antes de FAT e raiz (meta_commit).
+ */
+
+/* Cluster de índice lógico idx na cadeia iniciada em c (0 se a cadeia
+ * acaba antes). Percorre só a FAT em memória. */
+static uint16_t chain_at(Fat16Ctx *ctx, uint16_t c, uint32_t idx) {
+  for (uint32_t i = 0; i < idx; i++) {
+    if (c < 2 || c >= ctx->cluster_limit)
+      return 0;
+    c = fat_next(ctx, c);
   }
+  return (c >= 2 && c < ctx->cluster_limit) ? c : 0;
+}
 
-  int need =
-      (int)((fsz + (long)ctx->cluster_size - 1) / (long)ctx->cluster_size);
-  if (need <= 0)
-    need = 1;
+static uint32_t clusters_for(Fat16Ctx *ctx, uint32_t bytes) {
+  return (uint32_t)(((uint64_t)bytes + ctx->cluster_size - 1) /
+                    ctx->cluster_size);
+}
 
-  uint16_t *chain = (uint16_t *)malloc(sizeof(uint16_t) * (size_t)need);
-  if (!chain) {
-    printf("Memória insuficiente.\n");
-    fclose(src);
+/* O que file_reserve ligou à cadeia, para desfazer (file_unreserve). */
+typedef struct {
+  uint16_t tail;      /* último cluster antes da reserva (0 → sem cadeia) */
+  uint16_t tail_next; /* valor antigo de fat[tail] */
+  uint16_t added;     /* 1º cluster acrescentado (0 → nada mudou) */
+} FileReserve;
+
+/* Devolve os clusters acrescentados e religa a cadeia como estava. */
+static void file_unreserve(Fat16Ctx *ctx, DirectoryEntry *e,
+                           const FileReserve *rv) {
+  if (!rv->added)
     return;
+  uint16_t c = rv->added;
+  uint32_t steps = 0;
+  while (c >= 2 && c < ctx->cluster_limit && c < FAT16_EOF_MIN &&
+         steps++ <= ctx->cluster_count) {
+    uint16_t nx = fat_next(ctx, c);
+    fat_set(ctx, c, FAT16_FREE);
+    c = nx;
   }
+  if (rv->tail)
+    fat_set(ctx, rv->tail, rv->tail_next);
+  else
+    e->first_cluster_low = 0;
+}
 
-  uint16_t first = allocate_chain(ctx, need, chain);
-  if (first == 0) {
+/* Garante que a cadeia de e cubra new_size bytes: acrescenta primeiro os
+ * clusters livres contíguos ao último e o resto com allocate_chain. Em
+ * falha nada fica ligado; em sucesso rv diz o que foi acrescentado. */
+static int file_reserve(Fat16Ctx *ctx, DirectoryEntry *e, uint32_t new_size,
+                        FileReserve *rv) {
+  memset(rv, 0, sizeof(*rv));
+  /* conta até o fim real da cadeia, não pelo tamanho: uma cadeia maior
+   * que o arquivo ligaria os clusters novos no meio e perderia o resto */
+  uint32_t have = 0;
+  uint16_t tail = 0, c = e->first_cluster_low;
+  while (c >= 2 && c < ctx->cluster_limit && have < ctx->cluster_count) {
+    tail = c;
+    have++;
+    c = fat_next(ctx, c);
+  }
+  if (e->first_cluster_low && c < FAT16_EOF_MIN) {
+    printf("Cadeia interrompida.\n");
+    return 0;
+  }
+  uint32_t need = clusters_for(ctx, new_size);
+  if (need <= have)
+    return 1;
+  if (need - have > ctx->free_count) {
     printf("Sem clusters livres suficientes.\n");
-    free(chain);
-    fclose(src);
-    return;
+    return 0;
   }
+  if (!meta_before_alloc(ctx))
+    return 0;
 
-  uint8_t *buf = (uint8_t *)malloc(ctx->cluster_size);
-  if (!buf) {
-    printf("Memória insuficiente.\n");
+  rv->tail = tail;
+  rv->tail_next = tail ? ctx->fat[tail] : 0;
+  uint32_t add = need - have;
+  while (add > 0 && tail && (uint32_t)tail + 1 < ctx->cluster_limit &&
+         ctx->fat[tail + 1] == FAT16_FREE) {
+    if (!rv->added)
+      rv->added = (uint16_t)(tail + 1);
+    fat_set(ctx, tail, (uint16_t)(tail + 1));
+    fat_set(ctx, (uint16_t)(tail + 1), FAT16_EOF);
+    tail++;
+    add--;
+  }
+  if (add == 0)
+    return 1;
+  uint16_t *chain = (uint16_t *)malloc(sizeof(uint16_t) * add);
+  if (!chain || allocate_chain(ctx, (int)add, chain, NULL) == 0) {
     free(chain);
-    fclose(src);
-    return;
+    file_unreserve(ctx, e, rv); /* clusters contíguos já ligados */
+    printf("Sem clusters livres suficientes.\n");
+    return 0;
   }
+  if (!rv->added)
+    rv->added = chain[0];
+  if (tail)
+    fat_set(ctx, tail, chain[0]);
+  else
+    e->first_cluster_low = chain[0];
+  free(chain);
+  return 1;
+}
 
-  for (int i = 0; i < need; i++) {
-    size_t to_read = ctx->cluster_size;
-    if (i == need - 1) {
-      long rem = fsz - (long)i * (long)ctx->cluster_size;
-      if (rem < 0)
-        rem = 0;
-      if ((size_t)rem < to_read)
-        to_read = (size_t)rem;
+/*
+ * Grava len bytes em [off, off+len) do arquivo (cadeia já reservada);
+ * buf == NULL grava zeros. Clusters fisicamente contíguos viram uma
+ * escrita só; no modo esparso, clusters inteiros de zeros viram buracos.
+ */
+static int file_write_range(Fat16Ctx *ctx, const DirectoryEntry *e,
+                            uint32_t off, const uint8_t *buf, uint32_t len) {
+  static const uint8_t zeros[4096];
+  uint32_t cs = ctx->cluster_size;
+  uint16_t c = chain_at(ctx, e->first_cluster_low, off / cs);
+  uint32_t done = 0;
+  while (done < len) {
+    if (c == 0) {
+      printf("Cadeia interrompida.\n");
+      return 0;
     }
-    size_t got = fread(buf, 1, to_read, src);
-    if (got < to_read)
-      memset(buf + got, 0, ctx->cluster_size - got);
-
-    long off = cluster_offset(ctx, chain[i]);
-    fseek(ctx->img, off, SEEK_SET);
-    fwrite(buf, 1, ctx->cluster_size, ctx->img);
+    /* corrida contígua a partir de c, limitada ao que falta gravar */
+    uint32_t in = (off + done) % cs;
+    uint32_t span = cs - in;
+    uint16_t last = c;
+    while (done + span < len) {
+      uint16_t nx = fat_next(ctx, last);
+      if (nx != last + 1)
+        break;
+      last = nx;
+      span += cs;
+    }
+    if (span > len - done)
+      span = len - done;
+    long at = cluster_offset(ctx, c) + (long)in;
+    if (buf) {
+      if (!img_write(ctx, at, buf + done, span))
+        return 0;
+    } else if (ctx->sparse && in == 0 && span % cs == 0 &&
+               img_punch(ctx, at, span)) {
+      /* zeros sem gravar nada */
+    } else {
+      for (uint32_t z = 0; z < span;) {
+        uint32_t n = span - z < sizeof(zeros) ? span - z : sizeof(zeros);
+        if (!img_write(ctx, at + (long)z, zeros, n))
+          return 0;
+        z += n;
+      }
+    }
+    done += span;
+    c = (done < len) ? chain_at(ctx, last, 1) : 0;
   }
+  return 1;
+}
 
-  free(buf);
-  fclose(src);
-
-  memset(slot, 0, sizeof(*slot));
-  char n[8], x[3];
-  fat16_to83(dest83, n, x);
-  memcpy(slot->filename, n, 8);
-  memcpy(slot->extension, x, 3);
-  slot->attributes = ATTR_ARCHIVE;
-  slot->first_cluster_low = first;
-  slot->file_size = (uint32_t)fsz;
-
+static void file_touch(Fat16Ctx *ctx, DirectoryEntry *e) {
   uint16_t d, t;
   now_fat(&d, &t);
-  slot->creation_date = d;
-  slot->creation_time = t;
-  slot->last_mod_date = d;
-  slot->last_mod_time = t;
-  slot->last_access_date = d;
+  e->last_mod_date = d;
+  e->last_mod_time = t;
+  e->last_access_date = d;
+  e->attributes |= ATTR_ARCHIVE;
+  root_touch(ctx, e);
+  ext_cache_invalidate(ctx, e->first_cluster_low);
+  dir_cache_reset(ctx);
+}
 
-  if (!save_fat(ctx) || !save_root(ctx)) {
-    printf("Erro ao gravar metadados.\n");
-    free(chain);
-    return;
+static long write_at(Fat16Ctx *ctx, const char *name83, uint32_t off,
+                     const void *buf, size_t len, int append) {
+  DirectoryEntry *e = find_by_name(ctx, name83);
+  if (!e) {
+    printf("Arquivo '%s' não encontrado.\n", name83);
+    return -1;
   }
-  fflush(ctx->img);
-  free(chain);
-  printf("Criado '%s' (%ld bytes).\n", dest83, fsz);
+  if (append)
+    off = e->file_size;
+  if (len > UINT32_MAX - off) {
+    printf("Arquivo passaria de 4 GiB.\n");
+    return -1;
+  }
+  uint32_t end = off + (uint32_t)len;
+  uint32_t old = e->file_size;
+  uint16_t old_first = e->first_cluster_low;
+  FileReserve rv = {0, 0, 0};
+  if (end > old && !file_reserve(ctx, e, end, &rv))
+    return -1;
+  /* buraco entre o fim antigo e off: zeros (o resto do último cluster e
+   * clusters novos podem ter lixo) */
+  int ok = (off <= old || file_write_range(ctx, e, old, NULL, off - old)) &&
+           file_write_range(ctx, e, off, (const uint8_t *)buf, (uint32_t)len);
+  if (!ok) {
+    printf("Erro ao gravar '%s'.\n", name83);
+    /* o tamanho antigo vale: a cadeia volta a ser a de antes */
+    file_unreserve(ctx, e, &rv);
+  } else if (end > old) {
+    e->file_size = end;
+  }
+  ext_cache_invalidate(ctx, old_first);
+  file_touch(ctx, e);
+  if (!meta_commit(ctx, 0)) {
+    printf("Erro ao salvar metadados.\n");
+    return -1;
+  }
+  img_sync(ctx);
+  return ok ? (long)len : -1;
+}
+
+static int truncate_entry(Fat16Ctx *ctx, const char *name83,
+                          uint32_t size) {
+  DirectoryEntry *e = find_by_name(ctx, name83);
+  if (!e) {
+    printf("Arquivo '%s' não encontrado.\n", name83);
+    return 0;
+  }
+  uint32_t old = e->file_size;
+  if (size > old) {
+    /* cresce com zeros */
+    FileReserve rv;
+    if (!file_reserve(ctx, e, size, &rv))
+      return 0;
+    if (!file_write_range(ctx, e, old, NULL, size - old)) {
+      printf("Erro ao gravar '%s'.\n", name83);
+      file_unreserve(ctx, e, &rv);
+      ext_cache_invalidate(ctx, e->first_cluster_low);
+      return 0;
+    }
+    e->file_size = size;
+    file_touch(ctx, e);
+    if (!meta_commit(ctx, 0)) {
+      printf("Erro ao salvar metadados.\n");
+      return 0;
+    }
+    img_sync(ctx);
+    return 1;
+  }
+
+  /* encolhe: libera a cauda da cadeia (mantém ao menos um cluster, como
+   * os arquivos criados aqui) */
+  uint32_t keep = clusters_for(ctx, size);
+  if (keep == 0)
+    keep = 1;
+  ClusterRun *runs = NULL;
+  int nruns = 0, cap = 0;
+  uint16_t first = e->first_cluster_low;
+  ext_cache_invalidate(ctx, first);
+  uint16_t last = first ? chain_at(ctx, first, keep - 1) : 0;
+  if (last) {
+    uint16_t c = ctx->fat[last];
+    uint32_t steps = 0;
+    fat_set(ctx, last, FAT16_EOF);
+    while (c >= 2 && c < ctx->cluster_limit && c < FAT16_EOF_MIN) {
+      uint16_t nx = fat_next(ctx, c);
+      fat_set(ctx, c, FAT16_FREE);
+      if (ctx->sparse)
+        run_add(&runs, &nruns, &cap, c);
+      c = nx;
+      if (++steps > ctx->cluster_count + 8) {
+        printf("Loop suspeito.\n");
+        break;
+      }
+    }
+  }
+  e->file_size = size;
+  file_touch(ctx, e);
+  if (!meta_commit(ctx, ctx->sparse)) {
+    printf("Erro ao salvar metadados.\n");
+    free(runs);
+    return 0;
+  }
+  img_sync(ctx);
+  /* como no delete: buracos só depois do commit dos metadados */
+  for (int i = 0; i < nruns; i++)
+    img_punch(ctx, cluster_offset(ctx, runs[i].start),
+              (size_t)runs[i].len * ctx->cluster_size);
+  free(runs);
+  return 1;
+}
+
+long fat16_write_at(Fat16Ctx *ctx, const char *name83, uint32_t offset,
+                    const void *buf, size_t len) {
+  uint64_t t0 = op_begin();
+  ctx_wrlock(ctx);
+  long r = write_at(ctx, name83, offset, buf, len, 0);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_WRITE, t0);
+  return r;
+}
+
+long fat16_append(Fat16Ctx *ctx, const char *name83, const void *buf,
+                  size_t len) {
+  uint64_t t0 = op_begin();
+  ctx_wrlock(ctx);
+  long r = write_at(ctx, name83, 0, buf, len, 1);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_APPEND, t0);
+  return r;
+}
+
+int fat16_truncate(Fat16Ctx *ctx, const char *name83, uint32_t size) {
+  uint64_t t0 = op_begin();
+  ctx_wrlock(ctx);
+  int ok = truncate_entry(ctx, name83, size);
+  ctx_unlock(ctx);
+  op_end(ctx, FAT16_OP_TRUNCATE, t0);
+  return ok;
 }
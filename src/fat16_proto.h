@@ -0,0 +1,66 @@
+#ifndef FAT16_PROTO_H
+#define FAT16_PROTO_H
+#include <stdint.h>
+
+/*
+ * Protocolo entre fat16d (daemon) e fat16c (cliente), num socket Unix.
+ * Cada pedido é um cabeçalho Fat16Req seguido de len bytes de payload; cada
+ * resposta, um Fat16Resp seguido de len bytes. Inteiros em little-endian
+ * (ordem do host: o socket é local). O cliente pode enviar vários pedidos
+ * sem esperar as respostas (pipeline); elas voltam na mesma ordem, com o
+ * id do pedido.
+ *
+ * Payloads dos pedidos (nomes e caminhos sem '\0' final):
+ *   LIST     caminho ("" → raiz)        → n entradas DirectoryEntry (32 B)
+ *   STAT     caminho                    → 1 DirectoryEntry
+ *   READ     u32 offset, u32 len, caminho → até len bytes do arquivo
+ *   CREATE   u16 tam. do nome, nome, dados → vazio
+ *   RENAME   u16 tam. do antigo, antigo, novo → vazio
+ *   DELETE   nome                       → vazio
+ *   FLUSH    vazio                      → vazio
+ *   SHUTDOWN vazio                      → vazio (o daemon fecha os volumes
+ *                                          e sai)
+ * Alterações valem só no diretório raiz, como na API.
+ */
+
+#define FAT16_PROTO_MAX (16u << 20) /* maior payload aceito (16 MiB) */
+
+enum {
+  FAT16_P_LIST = 1,
+  FAT16_P_STAT,
+  FAT16_P_READ,
+  FAT16_P_CREATE,
+  FAT16_P_RENAME,
+  FAT16_P_DELETE,
+  FAT16_P_FLUSH,
+  FAT16_P_SHUTDOWN
+};
+
+/* status da resposta */
+enum {
+  FAT16_P_OK = 0,
+  FAT16_P_NOENT,  /* arquivo/diretório não existe */
+  FAT16_P_FAIL,   /* a operação falhou (nome em uso, sem espaço, E/S) */
+  FAT16_P_BADREQ, /* pedido malformado ou operação desconhecida */
+  FAT16_P_BADVOL  /* volume inexistente */
+};
+
+#pragma pack(push, 1)
+typedef struct {
+  uint32_t len; /* bytes de payload depois do cabeçalho */
+  uint8_t op;   /* FAT16_P_* */
+  uint8_t vol;  /* índice da imagem, na ordem da linha de comando do daemon */
+  uint16_t reserved;
+  uint32_t id; /* escolhido pelo cliente, devolvido na resposta */
+} Fat16Req;
+
+typedef struct {
+  uint32_t len;
+  uint8_t status; /* FAT16_P_OK ou erro */
+  uint8_t op;
+  uint16_t reserved;
+  uint32_t id;
+} Fat16Resp;
+#pragma pack(pop)
+
+#endif /* FAT16_PROTO_H */